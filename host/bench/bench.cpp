@@ -0,0 +1,725 @@
+// Cycle accurate benchmark of the rotator firmware under simavr
+// rototor_areg
+// VK5CD
+//
+// Runs the real ATmega328P firmware (the uno build, as shipped) instruction by
+// instruction, with
+//   - a scripted UART, for commands in any of the serial protocols
+//   - an I2C LSM303 stand-in, returning the raw sensor values for a simple
+//     model of the rotator
+//   - the motor direction/PWM outputs captured to drive that model
+// and reports the cycles taken by each measured function and loop(), and how
+// deep the stack got. Cycles are inclusive of anything called and of any
+// interrupts, and exclude time asleep. It also checks millis() keeps time
+// across the idle sleeps (see src/power.cpp), failing if not. The results only depend on the
+// firmware and scenario, so can be compared across commits (see
+// python/bench.py). A function the compiler inlined has no symbol, so is
+// reported as not found and its cycles count in its caller.
+//
+//   pio run -e uno && pio run -e bench
+//   .pio/build/bench/program .pio/build/uno/firmware.elf host/bench/scenarios/slew.txt
+//
+// Options
+//   --function <name>  measure another function (as many as needed)
+//   --csv              machine readable report
+//   --uart <file>      save everything the firmware sent
+//   --pwm <file>       save the motor pwm outputs as CSV, each time they change
+//   --nm <path>        avr-nm to read the firmware symbols with
+//
+// Scenario files have one step per line, "<msecs> <step> [args]", at that
+// simulated time since reset
+//   <msecs> position <heading> <pitch>  move the modelled rotator (degrees)
+//   <msecs> send <text>                 send text over the UART, with \n \r \\ \xNN escapes
+//                                       (no spaces, use \x20)
+//   <msecs> frame <address> <cmd> [<payload byte> ...]  send a multi-drop frame, adding the crc
+//   <msecs> end                         stop and report
+// with # comments.
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/avr_uart.h>
+#include <simavr/avr_twi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+const uint32_t bench_frequency = 16000000 ;
+const uint32_t bench_cycles_per_msec = bench_frequency / 1000 ;
+const uint16_t bench_ramend = 0x08FF ;
+
+// ATmega328P data space addresses of the motor outputs (see src/motors.h)
+// Az pwm on pin 6 (OC0A), direction pin 7, el pwm on pin 5 (OC0B), direction pin 4
+const uint16_t bench_portd = 0x2B ;
+const uint16_t bench_tccr0a = 0x44 ;
+const uint16_t bench_ocr0a = 0x47 ;
+const uint16_t bench_ocr0b = 0x48 ;
+const uint8_t bench_com0a = 0xC0 ;
+const uint8_t bench_com0b = 0x30 ;
+const uint8_t bench_az_pwm_bit = 6 ;
+const uint8_t bench_az_dir_bit = 7 ;
+const uint8_t bench_el_pwm_bit = 5 ;
+const uint8_t bench_el_dir_bit = 4 ;
+
+// Timer 0, whose overflow interrupt counts millis() (wiring.c adds 1 + 3/125
+// msec per overflow), and which src/power.cpp makes up for while asleep
+const uint16_t bench_tccr0b = 0x45 ;
+const uint16_t bench_timer0_prescales[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 } ;
+const double bench_msecs_per_overflow = 1.024 ;
+const double bench_millis_tolerance = 2.5 ; // an overflow, and power.cpp's own 3/125 fraction
+
+// LSM303 I2C stand-in, as set up by src/ahrs_sensors.cpp
+const uint8_t bench_accel_address = 0x19 ;
+const uint8_t bench_accel_out_x_l = 0x28 ;
+const uint8_t bench_mag_address = 0x1E ;
+const uint8_t bench_mag_out_x_h = 0x03 ;
+
+// Rotator model, same as host/sim/sim_hw.cpp (without the inertia)
+const float bench_az_degrees_per_sec = 6.0F ;
+const float bench_el_degrees_per_sec = 3.0F ;
+const int bench_deadband_pwm = 30 ;
+const float bench_gravity = 981.0F ;        // 0.01 m/s^2
+const float bench_mag_horizontal = 200.0F ; // 0.1 uT
+const float bench_mag_vertical = -400.0F ;
+
+// Hot paths measured by default
+const char * bench_default_functions[] = {
+  "loop",
+  "rotator_update",
+  "get_orientation",
+  "serial_data_handler",
+  "serial_spid_rot2_parse_direction",
+  "serial_spid_rot2_send_response",
+};
+
+struct bench_function
+{
+  std::string name ;
+  uint32_t address ;
+  uint32_t calls ;
+  uint64_t total_cycles ;
+  uint64_t min_cycles ;
+  uint64_t max_cycles ;
+  uint16_t max_stack ;   // bytes below RAMEND at the deepest
+};
+
+// A call in progress
+struct bench_frame
+{
+  bench_function * function ;
+  uint16_t sp ;          // SP once called
+  uint32_t return_pc ;   // where it returns to, from the return address pushed
+  uint64_t start_cycle ;
+  uint64_t start_slept ;
+  uint16_t min_sp ;
+};
+
+struct bench_step
+{
+  uint32_t msecs ;
+  std::string step ;
+  std::vector<std::string> args ;
+};
+
+avr_t * avr ;
+std::vector<bench_function> bench_functions ;
+std::map<uint32_t, bench_function *> bench_entries ;
+std::vector<bench_frame> bench_stack ;
+uint16_t bench_min_sp = bench_ramend ;
+uint64_t bench_slept_cycles = 0 ;
+
+std::deque<uint8_t> bench_uart_queue ;
+bool bench_uart_xon = true ;
+FILE * bench_uart_file = NULL ;
+uint32_t bench_uart_bytes = 0 ;
+
+float bench_heading = 0 ; // degrees, 0 north, positive clockwise
+float bench_pitch = 0 ;
+int bench_az_pwm = 0 ;
+int bench_el_pwm = 0 ;
+FILE * bench_pwm_file = NULL ;
+
+// millis() check, at each call of loop()
+uint16_t bench_millis_address = 0 ;   // timer0_millis in data space, 0 if not found
+bool bench_millis_started = false ;
+uint64_t bench_millis_cycle ;
+double bench_millis_expected ;
+uint32_t bench_millis_last ;
+uint32_t bench_millis_checks = 0 ;
+uint32_t bench_millis_backwards = 0 ;
+double bench_millis_worst = 0 ;       // expected - timer0_millis furthest from 0
+
+// ---- Symbols ----
+
+// Find the measured functions in the firmware with avr-nm
+bool bench_read_symbols(const char * elf, const char * nm)
+{
+  std::string cmd = std::string(nm) + " -C " + elf ;
+  FILE * pipe = popen(cmd.c_str(), "r");
+  if ( pipe == NULL )
+    return false ;
+
+  char line[512];
+  while ( fgets(line, sizeof(line), pipe) )
+  {
+    unsigned long address ;
+    char kind ;
+    char name[400];
+    if ( sscanf(line, "%lx %c %399[^\n]", &address, &kind, name) != 3 )
+      continue ;
+    if ( strchr("bBdD", kind) && strcmp(name, "timer0_millis") == 0 )
+      bench_millis_address = address & 0xFFFF ; // data space is at 0x800000 in the elf
+    if ( kind != 'T' && kind != 't' )
+      continue ;
+
+    // Demangled names have their arguments, e.g. get_orientation(ahrs_orientation*, bool)
+    char * args = strchr(name, '(');
+    if ( args )
+      *args = 0 ;
+    for ( size_t i = 0 ; i < bench_functions.size() ; i++ )
+      if ( bench_functions[i].name == name )
+        bench_functions[i].address = address ;
+  }
+  return pclose(pipe) == 0 ;
+}
+
+// ---- UART ----
+
+void bench_uart_out_hook(struct avr_irq_t * irq, uint32_t value, void * param)
+{
+  bench_uart_bytes ++ ;
+  if ( bench_uart_file )
+    fputc(value, bench_uart_file);
+}
+
+void bench_uart_xon_hook(struct avr_irq_t * irq, uint32_t value, void * param)
+{
+  bench_uart_xon = true ;
+}
+
+void bench_uart_xoff_hook(struct avr_irq_t * irq, uint32_t value, void * param)
+{
+  bench_uart_xon = false ;
+}
+
+void bench_uart_setup()
+{
+  // Don't let simavr print the UART to stdout
+  uint32_t flags = 0 ;
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+  flags &= ~AVR_UART_FLAG_STDIO ;
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), bench_uart_out_hook, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XON), bench_uart_xon_hook, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XOFF), bench_uart_xoff_hook, NULL);
+}
+
+// Feed queued bytes to the UART as it has room for them
+void bench_uart_update()
+{
+  avr_irq_t * in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+  while ( bench_uart_xon && ! bench_uart_queue.empty() )
+  {
+    avr_raise_irq(in, bench_uart_queue.front());
+    bench_uart_queue.pop_front();
+  }
+}
+
+// Queue text with C style escapes
+void bench_uart_send_text(const std::string & text)
+{
+  for ( size_t i = 0 ; i < text.size() ; i++ )
+  {
+    char c = text[i] ;
+    if ( c == '\\' && i + 1 < text.size() )
+    {
+      c = text[++i] ;
+      if ( c == 'n' ) c = '\n' ;
+      else if ( c == 'r' ) c = '\r' ;
+      else if ( c == 'x' && i + 2 < text.size() )
+      {
+        c = strtol(text.substr(i + 1, 2).c_str(), NULL, 16);
+        i += 2 ;
+      }
+    }
+    bench_uart_queue.push_back(c);
+  }
+}
+
+// Queue a multi-drop frame, see src/serial.cpp
+void bench_uart_send_frame(const std::vector<std::string> & args)
+{
+  std::vector<uint8_t> body ;
+  body.push_back(strtol(args[0].c_str(), NULL, 0));
+  body.push_back(strtol(args[1].c_str(), NULL, 0));
+  body.push_back(args.size() - 2);
+  for ( size_t i = 2 ; i < args.size() ; i++ )
+    body.push_back(strtol(args[i].c_str(), NULL, 0));
+
+  // CRC-16/CCITT, initial 0xFFFF
+  uint16_t crc = 0xFFFF ;
+  for ( size_t i = 0 ; i < body.size() ; i++ )
+  {
+    crc ^= body[i] << 8 ;
+    for ( int bit = 0 ; bit < 8 ; bit++ )
+      crc = crc & 0x8000 ? ( crc << 1 ) ^ 0x1021 : crc << 1 ;
+  }
+
+  bench_uart_queue.push_back(0x7E);
+  bench_uart_queue.insert(bench_uart_queue.end(), body.begin(), body.end());
+  bench_uart_queue.push_back(crc >> 8);
+  bench_uart_queue.push_back(crc & 0xFF);
+}
+
+// ---- LSM303 ----
+
+struct bench_i2c_device
+{
+  uint8_t registers[128] ;
+  uint8_t reg ;          // register pointer
+  bool reg_set ;         // first byte written after the address sets the pointer
+};
+
+bench_i2c_device bench_accel = { { 0 }, 0, false };
+bench_i2c_device bench_mag = { { 0 }, 0, false };
+bench_i2c_device * bench_i2c_selected = NULL ;
+avr_irq_t * bench_i2c_irq ;
+
+// Output registers for the modelled orientation, the inverse of the scaling
+// in src/ahrs_sensors.cpp, with the sensor level in roll
+void bench_sensor_registers()
+{
+  float pitch = bench_pitch * M_PI / 180 ;
+  float ahrs_heading = ( 180 - bench_heading ) * M_PI / 180 ;
+  float accel[3], mag[3] ;
+
+  accel[0] = - bench_gravity * sin(pitch) ;
+  accel[1] = 0 ;
+  accel[2] = bench_gravity * cos(pitch) ;
+  mag[0] = ( bench_mag_horizontal * cos(ahrs_heading) - bench_mag_vertical * sin(pitch) ) / cos(pitch) ;
+  mag[1] = - bench_mag_horizontal * sin(ahrs_heading) ;
+  mag[2] = bench_mag_vertical ;
+
+  // Accel 12 bit left justified, low byte first, 1mg per bit
+  for ( int i = 0 ; i < 3 ; i++ )
+  {
+    int16_t value = int16_t(lround(accel[i] * 100000 / 98066)) << 4 ;
+    bench_accel.registers[bench_accel_out_x_l + i * 2] = value & 0xFF ;
+    bench_accel.registers[bench_accel_out_x_l + i * 2 + 1] = ( value >> 8 ) & 0xFF ;
+  }
+
+  // Mag high byte first, X, Z, Y order, 1100 per gauss X/Y, 980 Z
+  int16_t mag_counts[3] = { int16_t(lround(mag[0] * 1100 / 1000)), int16_t(lround(mag[2] * 980 / 1000)),
+                            int16_t(lround(mag[1] * 1100 / 1000)) } ;
+  for ( int i = 0 ; i < 3 ; i++ )
+  {
+    bench_mag.registers[bench_mag_out_x_h + i * 2] = ( mag_counts[i] >> 8 ) & 0xFF ;
+    bench_mag.registers[bench_mag_out_x_h + i * 2 + 1] = mag_counts[i] & 0xFF ;
+  }
+}
+
+// TWI messages from the AVR master, as in simavr's i2c_eeprom example
+void bench_i2c_hook(struct avr_irq_t * irq, uint32_t value, void * param)
+{
+  avr_twi_msg_irq_t msg ;
+  msg.u.v = value ;
+
+  if ( msg.u.twi.msg & TWI_COND_STOP )
+    bench_i2c_selected = NULL ;
+
+  if ( msg.u.twi.msg & TWI_COND_START )
+  {
+    uint8_t address = msg.u.twi.addr >> 1 ;
+    bench_i2c_selected = address == bench_accel_address ? &bench_accel :
+                         address == bench_mag_address ? &bench_mag : NULL ;
+    if ( bench_i2c_selected )
+    {
+      bench_i2c_selected->reg_set = false ;
+      avr_raise_irq(bench_i2c_irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, msg.u.twi.addr, 1));
+    }
+  }
+
+  if ( bench_i2c_selected == NULL )
+    return ;
+
+  if ( msg.u.twi.msg & TWI_COND_WRITE )
+  {
+    avr_raise_irq(bench_i2c_irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, msg.u.twi.addr, 1));
+    if ( ! bench_i2c_selected->reg_set )
+    {
+      // 0x80 is the accel auto increment bit, which the stand-in always does
+      bench_i2c_selected->reg = msg.u.twi.data & 0x7F ;
+      bench_i2c_selected->reg_set = true ;
+      bench_sensor_registers();
+    }
+    else
+    {
+      bench_i2c_selected->registers[bench_i2c_selected->reg++ & 0x7F] = msg.u.twi.data ;
+    }
+  }
+
+  if ( msg.u.twi.msg & TWI_COND_READ )
+  {
+    uint8_t data = bench_i2c_selected->registers[bench_i2c_selected->reg++ & 0x7F] ;
+    avr_raise_irq(bench_i2c_irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, msg.u.twi.addr, data));
+  }
+}
+
+void bench_i2c_setup()
+{
+  static const char * names[2] = { "8>lsm303.out", "32<lsm303.in" };
+  bench_i2c_irq = avr_alloc_irq(&avr->irq_pool, 0, 2, names);
+  avr_irq_register_notify(bench_i2c_irq + TWI_IRQ_OUTPUT, bench_i2c_hook, NULL);
+  avr_connect_irq(bench_i2c_irq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+  avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), bench_i2c_irq + TWI_IRQ_OUTPUT);
+}
+
+// ---- Motors ----
+
+// Pwm of one timer 0 output, whether analogWrite() connected it or it is
+// just a digital output (analogWrite() of 0 or 255)
+int bench_pwm(uint8_t com_bits, uint16_t ocr, uint8_t pin_bit, uint8_t dir_bit, bool dir_high_positive)
+{
+  int pwm ;
+  if ( avr->data[bench_tccr0a] & com_bits )
+    pwm = avr->data[ocr] ;
+  else
+    pwm = avr->data[bench_portd] & ( 1 << pin_bit ) ? 255 : 0 ;
+
+  bool dir_high = avr->data[bench_portd] & ( 1 << dir_bit ) ;
+  return dir_high == dir_high_positive ? pwm : - pwm ;
+}
+
+float bench_rate(int pwm, float degrees_per_sec)
+{
+  if ( abs(pwm) <= bench_deadband_pwm )
+    return 0 ;
+  float rate = ( abs(pwm) - bench_deadband_pwm ) / float(255 - bench_deadband_pwm) * degrees_per_sec ;
+  return pwm > 0 ? rate : - rate ;
+}
+
+// Capture the motor outputs and move the model on by a msec
+void bench_motors_update(uint32_t msecs)
+{
+  // Az direction high is clockwise, el direction high is pitch down
+  int az_pwm = bench_pwm(bench_com0a, bench_ocr0a, bench_az_pwm_bit, bench_az_dir_bit, true);
+  int el_pwm = bench_pwm(bench_com0b, bench_ocr0b, bench_el_pwm_bit, bench_el_dir_bit, false);
+
+  if ( bench_pwm_file && ( az_pwm != bench_az_pwm || el_pwm != bench_el_pwm ) )
+    fprintf(bench_pwm_file, "%u,%d,%d\n", msecs, az_pwm, el_pwm);
+  bench_az_pwm = az_pwm ;
+  bench_el_pwm = el_pwm ;
+
+  bench_heading += bench_rate(az_pwm, bench_az_degrees_per_sec) / 1000 ;
+  if ( bench_heading > 180 ) bench_heading -= 360 ;
+  if ( bench_heading < -180 ) bench_heading += 360 ;
+  bench_pitch += bench_rate(el_pwm, bench_el_degrees_per_sec) / 1000 ;
+}
+
+// ---- Measurement ----
+
+uint16_t bench_sp()
+{
+  return avr->data[R_SPL] | ( avr->data[R_SPH] << 8 ) ;
+}
+
+// Check timer0_millis against the timer 0 overflows there have been, from the
+// cycles at its prescale (set once in setup), so any overflow src/power.cpp
+// misses or adds while asleep shows up. Called on entry to loop(), where no
+// overflow interrupt is part way through updating it.
+void bench_check_millis()
+{
+  if ( bench_millis_address == 0 )
+    return ;
+
+  uint32_t millis = 0 ;
+  for ( int i = 3 ; i >= 0 ; i-- )
+    millis = ( millis << 8 ) | avr->data[bench_millis_address + i] ;
+
+  if ( ! bench_millis_started )
+  {
+    bench_millis_started = true ;
+    bench_millis_expected = millis ;
+  }
+  else
+  {
+    uint16_t prescale = bench_timer0_prescales[avr->data[bench_tccr0b] & 0x07] ;
+    if ( prescale )
+      bench_millis_expected += double(avr->cycle - bench_millis_cycle) / ( 256.0 * prescale ) * bench_msecs_per_overflow ;
+    if ( millis < bench_millis_last )
+      bench_millis_backwards ++ ;
+    double error = bench_millis_expected - millis ;
+    if ( fabs(error) > fabs(bench_millis_worst) )
+      bench_millis_worst = error ;
+  }
+  bench_millis_cycle = avr->cycle ;
+  bench_millis_last = millis ;
+  bench_millis_checks ++ ;
+}
+
+// Whether millis() kept time, across any sleeps
+bool bench_millis_ok()
+{
+  return bench_millis_backwards == 0 && fabs(bench_millis_worst) <= bench_millis_tolerance ;
+}
+
+// Check for calls and returns after each instruction
+void bench_measure()
+{
+  uint16_t sp = bench_sp() ;
+  if ( sp < bench_min_sp )
+    bench_min_sp = sp ;
+
+  // Returned from the innermost call? SP alone can't tell, as prologues and
+  // epilogues write SPH before SPL so it briefly goes above where it was
+  while ( ! bench_stack.empty() && avr->pc == bench_stack.back().return_pc && sp > bench_stack.back().sp )
+  {
+    bench_frame & frame = bench_stack.back() ;
+    bench_function * f = frame.function ;
+    uint64_t cycles = ( avr->cycle - frame.start_cycle ) - ( bench_slept_cycles - frame.start_slept ) ;
+    uint16_t stack = bench_ramend - frame.min_sp ;
+
+    f->calls ++ ;
+    f->total_cycles += cycles ;
+    if ( f->calls == 1 || cycles < f->min_cycles ) f->min_cycles = cycles ;
+    if ( cycles > f->max_cycles ) f->max_cycles = cycles ;
+    if ( stack > f->max_stack ) f->max_stack = stack ;
+
+    uint16_t min_sp = frame.min_sp ;
+    bench_stack.pop_back();
+    if ( ! bench_stack.empty() && min_sp < bench_stack.back().min_sp )
+      bench_stack.back().min_sp = min_sp ;
+  }
+
+  if ( ! bench_stack.empty() && sp < bench_stack.back().min_sp )
+    bench_stack.back().min_sp = sp ;
+
+  // Called a measured function? The return address has just been pushed,
+  // high byte on top, in words
+  std::map<uint32_t, bench_function *>::iterator entry = bench_entries.find(avr->pc) ;
+  if ( entry != bench_entries.end() )
+  {
+    uint32_t return_pc = ( ( avr->data[sp + 1] << 8 ) | avr->data[sp + 2] ) * 2 ;
+    bench_frame frame = { entry->second, sp, return_pc, avr->cycle, bench_slept_cycles, sp } ;
+    bench_stack.push_back(frame);
+    if ( entry->second->name == "loop" )
+      bench_check_millis();
+  }
+}
+
+// ---- Scenario ----
+
+bool bench_read_scenario(const char * path, std::vector<bench_step> * steps)
+{
+  FILE * file = fopen(path, "r");
+  if ( file == NULL )
+    return false ;
+
+  char line[512];
+  while ( fgets(line, sizeof(line), file) )
+  {
+    char * comment = strchr(line, '#');
+    if ( comment )
+      *comment = 0 ;
+
+    bench_step step ;
+    char * word = strtok(line, " \t\r\n");
+    if ( word == NULL )
+      continue ;
+    step.msecs = atol(word);
+    word = strtok(NULL, " \t\r\n");
+    if ( word == NULL )
+      continue ;
+    step.step = word ;
+    while ( ( word = strtok(NULL, " \t\r\n") ) )
+      step.args.push_back(word);
+    steps->push_back(step);
+  }
+  fclose(file);
+  return true ;
+}
+
+// Apply a step, returning false at the end
+bool bench_run_step(const bench_step & step)
+{
+  if ( step.step == "position" && step.args.size() == 2 )
+  {
+    bench_heading = atof(step.args[0].c_str());
+    bench_pitch = atof(step.args[1].c_str());
+  }
+  else if ( step.step == "send" && step.args.size() == 1 )
+    bench_uart_send_text(step.args[0]);
+  else if ( step.step == "frame" && step.args.size() >= 2 )
+    bench_uart_send_frame(step.args);
+  else if ( step.step == "end" )
+    return false ;
+  else
+    fprintf(stderr, "bench: ignoring step at %u msecs: %s\n", step.msecs, step.step.c_str());
+  return true ;
+}
+
+// ---- Report ----
+
+void bench_report(const char * scenario, uint32_t msecs, bool csv)
+{
+  uint64_t awake = avr->cycle - bench_slept_cycles ;
+
+  if ( csv )
+  {
+    printf("scenario,function,calls,min_cycles,avg_cycles,max_cycles,max_stack\n");
+    for ( size_t i = 0 ; i < bench_functions.size() ; i++ )
+    {
+      bench_function & f = bench_functions[i] ;
+      printf("%s,%s,%u,%llu,%llu,%llu,%u\n", scenario, f.name.c_str(), f.calls,
+             (unsigned long long)f.min_cycles, (unsigned long long)( f.calls ? f.total_cycles / f.calls : 0 ),
+             (unsigned long long)f.max_cycles, f.max_stack);
+    }
+    printf("%s,(total),1,%llu,%llu,%llu,%u\n", scenario, (unsigned long long)awake, (unsigned long long)awake,
+           (unsigned long long)awake, bench_ramend - bench_min_sp);
+    return ;
+  }
+
+  printf("scenario: %s, %u msecs, %llu cycles, %.1f%% awake, %u uart bytes out\n", scenario, msecs,
+         (unsigned long long)avr->cycle, 100.0 * awake / avr->cycle, bench_uart_bytes);
+  printf("  %-34s %8s %10s %10s %10s %6s\n", "function", "calls", "min", "avg", "max", "stack");
+  for ( size_t i = 0 ; i < bench_functions.size() ; i++ )
+  {
+    bench_function & f = bench_functions[i] ;
+    if ( f.address == 0 )
+    {
+      printf("  %-34s not found (inlined?)\n", f.name.c_str());
+      continue ;
+    }
+    printf("  %-34s %8u %10llu %10llu %10llu %6u\n", f.name.c_str(), f.calls, (unsigned long long)f.min_cycles,
+           (unsigned long long)( f.calls ? f.total_cycles / f.calls : 0 ), (unsigned long long)f.max_cycles,
+           f.max_stack);
+  }
+  printf("  max stack %u bytes\n", bench_ramend - bench_min_sp);
+  if ( bench_millis_address == 0 )
+    printf("  millis not checked, no timer0_millis\n");
+  else
+    printf("  millis %s: %u checks, worst %.2f msecs behind the timer 0 overflows, went back %u times\n",
+           bench_millis_ok() ? "ok" : "WRONG", bench_millis_checks, bench_millis_worst, bench_millis_backwards);
+}
+
+int main(int argc, char ** argv)
+{
+  const char * elf = NULL ;
+  const char * scenario = NULL ;
+  const char * nm = "avr-nm" ;
+  bool csv = false ;
+  std::vector<std::string> names(bench_default_functions,
+                                 bench_default_functions + sizeof(bench_default_functions) / sizeof(char *));
+
+  for ( int i = 1 ; i < argc ; i++ )
+  {
+    if ( strcmp(argv[i], "--function") == 0 && i + 1 < argc )
+      names.push_back(argv[++i]);
+    else if ( strcmp(argv[i], "--csv") == 0 )
+      csv = true ;
+    else if ( strcmp(argv[i], "--uart") == 0 && i + 1 < argc )
+      bench_uart_file = fopen(argv[++i], "wb");
+    else if ( strcmp(argv[i], "--pwm") == 0 && i + 1 < argc )
+      bench_pwm_file = fopen(argv[++i], "w");
+    else if ( strcmp(argv[i], "--nm") == 0 && i + 1 < argc )
+      nm = argv[++i] ;
+    else if ( elf == NULL )
+      elf = argv[i] ;
+    else
+      scenario = argv[i] ;
+  }
+  if ( elf == NULL || scenario == NULL )
+  {
+    fprintf(stderr, "usage: %s [--function <name>] [--csv] [--uart <file>] [--pwm <file>] [--nm <path>] "
+                    "<firmware.elf> <scenario>\n", argv[0]);
+    return 2 ;
+  }
+
+  for ( size_t i = 0 ; i < names.size() ; i++ )
+  {
+    bench_function f = { names[i], 0, 0, 0, 0, 0, 0 } ;
+    bench_functions.push_back(f);
+  }
+  if ( ! bench_read_symbols(elf, nm) )
+  {
+    fprintf(stderr, "bench: can't read symbols with %s\n", nm);
+    return 1 ;
+  }
+  for ( size_t i = 0 ; i < bench_functions.size() ; i++ )
+    if ( bench_functions[i].address )
+      bench_entries[bench_functions[i].address] = &bench_functions[i] ;
+
+  std::vector<bench_step> steps ;
+  if ( ! bench_read_scenario(scenario, &steps) )
+  {
+    perror(scenario);
+    return 1 ;
+  }
+
+  elf_firmware_t firmware ;
+  memset(&firmware, 0, sizeof(firmware));
+  if ( elf_read_firmware(elf, &firmware) != 0 )
+  {
+    fprintf(stderr, "bench: can't load %s\n", elf);
+    return 1 ;
+  }
+  avr = avr_make_mcu_by_name("atmega328p");
+  avr_init(avr);
+  avr->frequency = bench_frequency ;
+  avr_load_firmware(avr, &firmware);
+  bench_uart_setup();
+  bench_i2c_setup();
+
+  // Run to the end of the scenario
+  size_t next_step = 0 ;
+  uint32_t msecs = 0 ;
+  bool running = true ;
+  while ( running )
+  {
+    uint64_t cycle = avr->cycle ;
+    int state = avr_run(avr);
+    if ( state == cpu_Done || state == cpu_Crashed )
+    {
+      fprintf(stderr, "bench: firmware %s at %u msecs\n", state == cpu_Done ? "stopped" : "crashed", msecs);
+      break ;
+    }
+    if ( avr->state == cpu_Sleeping )
+      bench_slept_cycles += avr->cycle - cycle ;
+    else
+      bench_measure();
+
+    // Every simulated msec
+    while ( avr->cycle >= uint64_t(msecs + 1) * bench_cycles_per_msec )
+    {
+      msecs ++ ;
+      bench_motors_update(msecs);
+      while ( running && next_step < steps.size() && steps[next_step].msecs <= msecs )
+        running = bench_run_step(steps[next_step++]);
+      bench_uart_update();
+      if ( next_step == steps.size() )
+        running = false ;
+    }
+  }
+
+  const char * name = strrchr(scenario, '/') ;
+  bench_report(name ? name + 1 : scenario, msecs, csv);
+  if ( bench_uart_file )
+    fclose(bench_uart_file);
+  if ( bench_pwm_file )
+    fclose(bench_pwm_file);
+  if ( ! bench_millis_ok() )
+  {
+    fprintf(stderr, "bench: millis() wrong, worst %.2f msecs behind, went back %u times\n",
+            bench_millis_worst, bench_millis_backwards);
+    return 1 ;
+  }
+  return 0 ;
+}
@@ -0,0 +1,53 @@
+// Host stand-in for the Arduino core and ATmega328P timers, for power_check
+// rototor_areg
+// VK5CD
+//
+// Only what src/power.cpp uses. The timer registers are modelled against a
+// count of CPU cycles (see power_check.cpp), so reading and writing them
+// behaves as on the AVR, including timer 0 overflowing and interrupting.
+
+#ifndef HOST_POWER_ARDUINO_H
+#define HOST_POWER_ARDUINO_H
+
+#include <stdint.h>
+
+typedef uint8_t byte;
+
+template <typename T, typename U> T min(T a, U b) { return a < b ? a : T(b); }
+
+#define _BV(bit) (1 << (bit))
+
+// Register bits, as avr/iom328p.h
+#define TOV0 0
+#define TOIE0 0
+#define WGM21 1
+#define OCF2A 1
+#define OCIE2A 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define PSRASY 1
+
+enum power_check_register { reg_tcnt0, reg_tifr0, reg_timsk0, reg_tcnt2, reg_ocr2a, reg_tifr2, reg_timsk2,
+                            reg_tccr2a, reg_tccr2b, reg_gtccr };
+
+uint8_t power_check_read(power_check_register reg);
+void power_check_write(power_check_register reg, uint8_t value);
+
+// An 8 bit register, each access takes a cycle
+struct power_check_io
+{
+  power_check_register reg ;
+  operator uint8_t() const { return power_check_read(reg); }
+  power_check_io & operator=(uint8_t value) { power_check_write(reg, value); return *this; }
+  power_check_io & operator|=(uint8_t value) { power_check_write(reg, power_check_read(reg) | value); return *this; }
+  power_check_io & operator&=(uint8_t value) { power_check_write(reg, power_check_read(reg) & value); return *this; }
+};
+
+extern power_check_io TCNT0, TIFR0, TIMSK0, TCNT2, OCR2A, TIFR2, TIMSK2, TCCR2A, TCCR2B, GTCCR ;
+
+void cli();
+void sei();
+unsigned long micros();
+
+#endif
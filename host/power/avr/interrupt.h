@@ -0,0 +1,6 @@
+// Host stand-in for avr/interrupt.h, for power_check
+// rototor_areg
+// VK5CD
+
+// The wake interrupt does nothing, power_check.cpp models the wake itself
+#define EMPTY_INTERRUPT(vector) void vector##_unused()
@@ -0,0 +1,10 @@
+// Host stand-in for avr/sleep.h, for power_check
+// rototor_areg
+// VK5CD
+
+#define SLEEP_MODE_IDLE 0
+
+void set_sleep_mode(int mode);
+void sleep_enable();
+void sleep_disable();
+void sleep_cpu();
@@ -0,0 +1,239 @@
+// Host check of the millis() and micros() accounting across idle sleeps
+// rototor_areg
+// VK5CD
+//
+// Runs the real src/power.cpp against a cycle count model of timers 0 and 2
+// and the Arduino core's timer 0 overflow interrupt (wiring.c), with timer 0
+// at /8 for the motor pwm as motors.cpp sets it. The main loop is awake for
+// a random time, then sleeps until timer 2 or, some of the time, serial rx
+// at a random time. After each sleep timer0_overflow_count and timer0_millis
+// have to be as if the overflow interrupt had run every time, millis() must
+// never go back, and power_sleep() has to return the time it slept.
+//
+// power.cpp keeps its own 3/125 msec fraction (wiring.c's is static), so
+// millis() can be up to 1 behind, but never further as the two fractions
+// only add up.
+//
+// Build and run with
+//   pio run -e power
+//   .pio/build/power/program [<sleeps>]
+//
+// Exits non zero if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+// wiring.c counts, as power.cpp expects to find them
+volatile unsigned long timer0_overflow_count = 0 ;
+volatile unsigned long timer0_millis = 0 ;
+unsigned char timer0_fract = 0 ;
+
+power_check_io TCNT0 = { reg_tcnt0 }, TIFR0 = { reg_tifr0 }, TIMSK0 = { reg_timsk0 }, TCNT2 = { reg_tcnt2 },
+               OCR2A = { reg_ocr2a }, TIFR2 = { reg_tifr2 }, TIMSK2 = { reg_timsk2 }, TCCR2A = { reg_tccr2a },
+               TCCR2B = { reg_tccr2b }, GTCCR = { reg_gtccr } ;
+
+unsigned long power_sleep();
+void power_setup();
+
+// Timer 0 at /8 overflows every 2048 cycles, timer 2 at /1024 ticks every 1024
+const uint64_t check_overflow_cycles = 2048 ;
+const uint64_t check_tick_cycles = 1024 ;
+const uint64_t check_isr_cycles = 60 ;      // overflow interrupt, about as long as wiring.c's
+const uint64_t check_wake_cycles = 14 ;     // wake up and the empty wake interrupt
+const uint64_t check_settle_cycles = 100 ;  // after a sleep, for any pending overflow interrupt
+
+uint64_t check_cycles = 0 ;
+uint64_t check_overflows = 0 ;  // made by timer 0
+bool check_tov0 = false ;
+bool check_interrupts = true ;
+uint8_t check_timsk0 = _BV(TOIE0), check_timsk2 = 0, check_ocr2a = 0, check_tccr2b = 0 ;
+uint64_t check_timer2_start = 0 ;
+uint64_t check_rx_cycle = 0 ;   // serial rx wakes the MCU at this cycle
+unsigned long check_isr_runs = 0 ;
+
+// wiring.c TIMER0_OVF_vect
+void check_timer0_overflow()
+{
+  unsigned long m = timer0_millis ;
+  unsigned char f = timer0_fract ;
+  m += 1 ;
+  f += 3 ;
+  if ( f >= 125 )
+  {
+    f -= 125 ;
+    m += 1 ;
+  }
+  timer0_fract = f ;
+  timer0_millis = m ;
+  timer0_overflow_count ++ ;
+  check_isr_runs ++ ;
+}
+
+// Run the timers on by some cycles, taking any overflow interrupt
+void check_run(uint64_t cycles)
+{
+  uint64_t end = check_cycles + cycles ;
+  while ( check_cycles < end )
+  {
+    if ( check_interrupts && check_tov0 && ( check_timsk0 & _BV(TOIE0) ) )
+    {
+      check_tov0 = false ;
+      check_cycles += check_isr_cycles ;
+      check_timer0_overflow() ;
+      continue ;
+    }
+    uint64_t next = ( check_overflows + 1 ) * check_overflow_cycles ;
+    if ( next > end )
+    {
+      check_cycles = end ;
+      break ;
+    }
+    check_cycles = next ;
+    check_overflows ++ ;
+    check_tov0 = true ;
+  }
+}
+
+uint8_t power_check_read(power_check_register reg)
+{
+  check_run(1) ;
+  switch ( reg )
+  {
+    case reg_tcnt0:
+      return ( check_cycles / 8 ) & 0xFF ;
+    case reg_tifr0:
+      return check_tov0 ? _BV(TOV0) : 0 ;
+    case reg_timsk0:
+      return check_timsk0 ;
+    case reg_tcnt2:
+      return check_tccr2b ? min(( check_cycles - check_timer2_start ) / check_tick_cycles, uint64_t(255)) : 0 ;
+    default:
+      return 0 ;
+  }
+}
+
+void power_check_write(power_check_register reg, uint8_t value)
+{
+  check_run(1) ;
+  switch ( reg )
+  {
+    case reg_tifr0:
+      if ( value & _BV(TOV0) )
+        check_tov0 = false ;
+      break ;
+    case reg_timsk0:
+      check_timsk0 = value ;
+      break ;
+    case reg_ocr2a:
+      check_ocr2a = value ;
+      break ;
+    case reg_timsk2:
+      check_timsk2 = value ;
+      break ;
+    case reg_tccr2b:
+      check_tccr2b = value ;
+      break ;
+    case reg_gtccr:
+      if ( value & _BV(PSRASY) )
+        check_timer2_start = check_cycles ; // prescaler reset
+      break ;
+    default:
+      break ;
+  }
+}
+
+void cli()
+{
+  check_run(1) ;
+  check_interrupts = false ;
+}
+
+void sei()
+{
+  check_run(1) ;
+  check_interrupts = true ;
+}
+
+void set_sleep_mode(int mode) {}
+void sleep_enable() { check_run(1) ; }
+void sleep_disable() { check_run(1) ; }
+
+// Sleep until timer 2 matches OCR2A, serial rx, or a timer 0 overflow
+// interrupt if it was left on
+void sleep_cpu()
+{
+  check_run(1) ; // sei() lets one more instruction run first
+  uint64_t wake = check_rx_cycle ;
+  if ( check_tccr2b && ( check_timsk2 & _BV(OCIE2A) ) )
+    wake = min(wake, check_timer2_start + check_ocr2a * check_tick_cycles) ;
+  unsigned long runs = check_isr_runs ;
+  while ( check_cycles < wake && check_isr_runs == runs )
+    check_run(min(wake - check_cycles, uint64_t(64))) ;
+  check_run(check_wake_cycles) ;
+}
+
+// wiring.c micros(), at /8 it goes up 4 per timer 0 count
+unsigned long micros()
+{
+  bool interrupts = check_interrupts ;
+  cli() ;
+  unsigned long m = timer0_overflow_count ;
+  uint8_t t = TCNT0 ;
+  if ( ( TIFR0 & _BV(TOV0) ) && t < 255 )
+    m ++ ;
+  if ( interrupts )
+    sei() ;
+  return ( ( m << 8 ) + t ) * 4 ;
+}
+
+int main(int argc, char ** argv)
+{
+  long sleeps = argc > 1 ? atol(argv[1]) : 20000 ;
+  long count_errors = 0, millis_errors = 0, backwards = 0, slept_errors = 0 ;
+  long most_behind = 0 ;
+  double worst_slept = 0 ;
+  unsigned long last_millis = 0 ;
+
+  srand(1) ;
+  power_setup() ;
+  for ( long n = 0 ; n < sleeps ; n++ )
+  {
+    check_run(rand() % 5000) ; // awake
+    check_rx_cycle = rand() % 3 == 0 ? check_cycles + rand() % 400000 : UINT64_MAX ;
+
+    uint64_t start = check_cycles ;
+    unsigned long slept = power_sleep() ;
+    uint64_t end = check_cycles ;
+    check_run(check_settle_cycles) ;
+
+    // As if the overflow interrupt had run every time, less one still pending
+    uint64_t overflows = check_overflows - ( check_tov0 ? 1 : 0 ) ;
+    uint64_t millis = overflows + overflows * 3 / 125 ;
+    long behind = long(millis) - long(timer0_millis) ;
+    if ( timer0_overflow_count != overflows )
+      count_errors ++ ;
+    if ( behind < 0 || behind > 1 )
+      millis_errors ++ ;
+    if ( behind > most_behind )
+      most_behind = behind ;
+    if ( timer0_millis < last_millis )
+      backwards ++ ;
+    last_millis = timer0_millis ;
+
+    // micros() goes up 4 per 8 cycles, the wake is counted as asleep
+    double error = ( end - start ) / 2.0 - slept ;
+    if ( error < 0 || error > 200 )
+      slept_errors ++ ;
+    if ( fabs(error) > worst_slept )
+      worst_slept = fabs(error) ;
+  }
+
+  printf("sleeps: %ld over %.1f secs, overflow count errors: %ld, millis errors: %ld (at most %ld behind), "
+         "millis went back: %ld, slept time errors: %ld (worst %.0f usecs)\n",
+         sleeps, check_cycles / 16e6, count_errors, millis_errors, most_behind, backwards, slept_errors, worst_slept) ;
+  return count_errors || millis_errors || backwards || slept_errors ? 1 : 0 ;
+}
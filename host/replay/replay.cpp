@@ -0,0 +1,246 @@
+// Host replay of a captured rotator trace
+// rototor_areg
+// VK5CD
+//
+// Feeds the recorded sensor samples, times and commands from a trace
+// (see python/trace_capture.py) back through the unmodified rotator and AHRS
+// code, and checks every update it produces matches what the rotator recorded.
+//
+// Build and run with
+//   pio run -e replay
+//   .pio/build/replay/program <trace file> [-v]
+//
+// Exits non zero if any update differs, or nothing could be replayed, so can
+// be used to regression test control/filter changes against field traces.
+//
+// Only traces recorded with decimation 1 ('r1') replay exactly, as they have
+// every update and command. Gaps in the trace (decimation, records lost in
+// capture, or a routine running) pause the replay until the rotator has sent
+// all the parts of a new snapshot after the gap (see trace.h).
+//
+// NOTE: the AVR and host maths libraries can differ in the last bit for
+// sin/cos/atan, which very occasionally shows up as a one step heading
+// difference. Any other difference is a change in behaviour.
+
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "rotator.h"
+#include "ahrs.h"
+#include "trace.h"
+#include "fault.h"
+#include "replay.h"
+
+// Max mismatches to print unless verbose
+const int replay_quiet_mismatches = 10 ;
+
+// Find the next valid record in data from pos onwards
+// Returns false when no more records
+bool replay_next_record(const std::vector<byte> & data, size_t & pos,
+                        byte & type, const byte * & payload, byte & len)
+{
+  while ( pos + 6 <= data.size() )
+  {
+    if ( data[pos] != trace_sync_1 || data[pos+1] != trace_sync_2 )
+    {
+      pos ++ ;
+      continue ;
+    }
+
+    len = data[pos+3] ;
+    if ( pos + 6 + len > data.size() )
+      return false ;
+
+    // Fletcher-16 over type, length and payload
+    unsigned check_a = 0, check_b = 0 ;
+    for ( size_t i = pos + 2 ; i < pos + 4 + len ; i++ )
+    {
+      check_a = ( check_a + data[i] ) % 255 ;
+      check_b = ( check_b + check_a ) % 255 ;
+    }
+    if ( check_a != data[pos+4+len] || check_b != data[pos+5+len] )
+    {
+      pos ++ ; // false sync, e.g. in CLI text, keep looking
+      continue ;
+    }
+
+    type = data[pos+2] ;
+    payload = &data[pos+4] ;
+    pos += 6 + len ;
+    return true ;
+  }
+  return false ;
+}
+
+void replay_print_update(const char * label, const trace_update_record * rec)
+{
+  printf("  %s: t=%u hdg=%d pitch=%d target=%d,%d pwm=%d,%d\n", label,
+         (unsigned)rec->msecs, rec->heading, rec->pitch,
+         rec->target_heading, rec->target_pitch, rec->az_pwm, rec->el_pwm);
+}
+
+int main(int argc, char ** argv)
+{
+  if ( argc < 2 )
+  {
+    fprintf(stderr, "usage: %s <trace file> [-v]\n", argv[0]);
+    return 2 ;
+  }
+  bool verbose = argc > 2 && strcmp(argv[2], "-v") == 0 ;
+
+  FILE * f = fopen(argv[1], "rb");
+  if ( ! f )
+  {
+    perror(argv[1]);
+    return 2 ;
+  }
+  std::vector<byte> data ;
+  int c ;
+  while ( ( c = fgetc(f) ) != EOF )
+    data.push_back(c) ;
+  fclose(f);
+
+  // Start the rotator as it would at power on, a state record will
+  // override this before anything is replayed
+  memset(&replay_raw, 0, sizeof(replay_raw));
+  rotator_setup();
+  trace_set_decimation(1); // so we can compare every update we replay
+  trace_set_synced();
+
+  bool synced = false ;
+  int parts = 0 ;             // parts of a snapshot seen so far, in order
+  uint16_t last_tick = 0 ;
+  long updates = 0, matched = 0, mismatched = 0, skipped = 0 ;
+  long moving = 0 ;           // matched with a motor driven
+  long commands = 0, snapshots = 0 ;
+
+  size_t pos = 0 ;
+  byte type, len ;
+  const byte * payload ;
+  while ( replay_next_record(data, pos, type, payload, len) )
+  {
+    if ( type == trace_type_tuning && len == sizeof(uint16_t) + 2 * sizeof(rotator_axis_tuning) )
+    {
+      rotator_axis_tuning tuning ;
+      memcpy(&tuning, payload + sizeof(uint16_t), sizeof(tuning));
+      rotator_set_tuning(rotator_axis_az, &tuning);
+      memcpy(&tuning, payload + sizeof(uint16_t) + sizeof(tuning), sizeof(tuning));
+      rotator_set_tuning(rotator_axis_el, &tuning);
+      parts = 1 ;
+    }
+    else if ( type == trace_type_fault && len == sizeof(uint16_t) + sizeof(fault_window_state) )
+    {
+      // Sent again if the window moved on before the state part
+      if ( parts == 0 )
+        continue ;
+      fault_window_state window ;
+      memcpy(&window, payload + sizeof(uint16_t), sizeof(window));
+      fault_restore_window(&window);
+      parts = 2 ;
+    }
+    else if ( type == trace_type_state && len == sizeof(uint16_t) + sizeof(rotator_state) )
+    {
+      // Only a whole snapshot, not the end of one from before the trace started
+      if ( parts != 2 )
+        continue ;
+      rotator_state state ;
+      memcpy(&last_tick, payload, sizeof(uint16_t));
+      memcpy(&state, payload + sizeof(uint16_t), sizeof(state));
+      rotator_restore_state(&state);
+      parts = 0 ;
+      synced = true ;
+      snapshots ++ ;
+    }
+    else if ( type == trace_type_command && len == sizeof(trace_command_record) )
+    {
+      trace_command_record rec ;
+      memcpy(&rec, payload, sizeof(rec));
+      if ( ! synced || rec.tick != last_tick )
+      {
+        synced = false ;
+        skipped ++ ;
+        continue ;
+      }
+
+      memcpy(replay_raw.accel, rec.accel, sizeof(rec.accel));
+      memcpy(replay_raw.mag, rec.mag, sizeof(rec.mag));
+      switch ( rec.command )
+      {
+        case 't': rotator_target_orientation(rec.azimuth, rec.elevation); break;
+        case 'h': rotator_home_orientation(); break;
+        case 's': rotator_stop_motors(); break;
+        case 'e': rotator_emergency_stop_motors(); break;
+        case 'i': rotator_identify(rec.azimuth); break;
+        case 'c': rotator_magcal(rec.azimuth); break;
+      }
+      commands ++ ;
+    }
+    else if ( type == trace_type_update && len == sizeof(trace_update_record) )
+    {
+      trace_update_record rec ;
+      memcpy(&rec, payload, sizeof(rec));
+      if ( ! synced || rec.tick != uint16_t(last_tick + 1) )
+      {
+        synced = false ;
+        skipped ++ ;
+        continue ;
+      }
+      last_tick = rec.tick ;
+
+      // Run one iteration with the recorded time and sensor sample
+      replay_msecs = rec.msecs ;
+      memcpy(replay_raw.accel, rec.accel, sizeof(rec.accel));
+      memcpy(replay_raw.mag, rec.mag, sizeof(rec.mag));
+      replay_output.clear();
+      rotator_update();
+      updates ++ ;
+
+      // Compare the update record our run produced, ignoring the tick
+      size_t out_pos = 0 ;
+      byte out_type, out_len ;
+      const byte * out_payload ;
+      trace_update_record out ;
+      bool found = false ;
+      while ( replay_next_record(replay_output, out_pos, out_type, out_payload, out_len) )
+      {
+        if ( out_type == trace_type_update && out_len == sizeof(out) )
+        {
+          memcpy(&out, out_payload, sizeof(out));
+          found = true ;
+          break ;
+        }
+      }
+      out.tick = rec.tick ;
+
+      if ( found && memcmp(&out, &rec, sizeof(rec)) == 0 )
+      {
+        matched ++ ;
+        if ( rec.az_pwm != 0 || rec.el_pwm != 0 )
+          moving ++ ;
+      }
+      else
+      {
+        mismatched ++ ;
+        if ( verbose || mismatched <= replay_quiet_mismatches )
+        {
+          printf("mismatch at tick %u\n", (unsigned)rec.tick);
+          replay_print_update("recorded", &rec);
+          if ( found )
+            replay_print_update("replayed", &out);
+        }
+      }
+    }
+  }
+
+  printf("snapshots: %ld commands: %ld updates: %ld matched: %ld (moving: %ld) mismatched: %ld skipped: %ld\n",
+         snapshots, commands, updates, matched, moving, mismatched, skipped);
+
+  if ( updates == 0 )
+  {
+    printf("nothing replayed, was the trace recorded with 'r1'?\n");
+    return 1 ;
+  }
+  return mismatched ? 1 : 0 ;
+}
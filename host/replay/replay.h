@@ -0,0 +1,11 @@
+// Shared values between the replay harness and its hardware stand-ins
+// rototor_areg
+// VK5CD
+
+#include <vector>
+
+extern std::vector<byte> replay_output ;
+extern unsigned long replay_msecs ;
+extern ahrs_raw_values replay_raw ;
+extern int replay_az_pwm ;
+extern int replay_el_pwm ;
@@ -0,0 +1,94 @@
+// Host replacements for the hardware facing rotator code
+// rototor_areg
+// VK5CD
+//
+// Stands in for ahrs_sensors.cpp and motors.cpp so the recorded sensor
+// samples are fed to, and the motor commands captured from, the otherwise
+// unmodified rotator code
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include <vector>
+
+#include "config.h"
+#include "ahrs.h"
+#include "motors.h"
+#include "rotator.h"
+#include "magcal.h"
+#include "replay.h"
+
+HostSerial Serial;
+EEPROMClass EEPROM; // erased, so default tuning
+std::vector<byte> replay_output ;
+uint8_t UCSR0A = 0 ;
+
+// Values replay.cpp sets before each call into the rotator code
+unsigned long replay_msecs = 0 ;
+ahrs_raw_values replay_raw ;
+
+// Values captured from the rotator code
+int replay_az_pwm = 0 ;
+int replay_el_pwm = 0 ;
+
+unsigned long millis()
+{
+  return replay_msecs * millis_correction ;
+}
+
+void delay(unsigned long ms)
+{
+}
+
+// Capture everything the rotator code writes, so replay can check the trace
+// records it produces
+size_t HostSerial::write(const byte * buf, size_t len)
+{
+  replay_output.insert(replay_output.end(), buf, buf + len);
+  return len ;
+}
+
+int HostSerial::availableForWrite()
+{
+  return 1024 ; // never drop records on the host
+}
+
+void HostSerial::begin(long speed) {}
+int HostSerial::available() { return 0; }
+int HostSerial::read() { return -1; }
+size_t HostSerial::print(long value) { return 0; }
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {}
+
+void ahrs_setup()
+{
+}
+
+// Recorded after magcal_compensate(), so already as used
+void ahrs_read_raw(ahrs_raw_values * raw)
+{
+  *raw = replay_raw ;
+}
+
+void ahrs_set_low_power(bool low_power)
+{
+}
+
+void motors_setup()
+{
+  replay_az_pwm = 0 ;
+  replay_el_pwm = 0 ;
+}
+
+void set_el_motor_pwm_speed(int pwm_speed)
+{
+  replay_el_pwm = pwm_speed ;
+  magcal_motor_pwm(rotator_axis_el, pwm_speed);
+}
+
+void set_az_motor_pwm_speed(int pwm_speed)
+{
+  replay_az_pwm = pwm_speed ;
+  magcal_motor_pwm(rotator_axis_az, pwm_speed);
+}
@@ -0,0 +1,175 @@
+// Host simulation of a complete rotator on a pseudo terminal
+// rototor_areg
+// VK5CD
+//
+// Runs the real setup()/loop() from main.cpp, including all the serial
+// protocols, against a simple model of the rotator hardware (sim_hw.cpp).
+// The serial port is a pty, so host tools can talk to it like a real rotator
+// with no hardware, e.g. for python/multidrop_bus_test.py. Writes to it only
+// go as fast as the real serial port, through a tx buffer the same size.
+//
+// Build and run with
+//   pio run -e sim
+//   .pio/build/sim/program [--address <n>] [--heading <degrees>] [--jam <0|1>] [--backlash <degrees>]
+//                          [--interference <uT>] [--link <path>]
+//
+// Prints the pty path to use on startup, --link also makes a symlink to it.
+// --jam 1 jams the azimuth axis, so it won't turn however it is driven.
+// --backlash gives both axes that much play in their gears.
+// --interference disturbs the magnetometer by that much with a motor at full pwm.
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "config.h"
+#include "sim.h"
+
+void setup();
+void loop();
+
+HostSerial Serial;
+EEPROMClass EEPROM;
+uint8_t UCSR0A = _BV(TXC0) ; // as soon as the tx buffer is empty
+
+int sim_pty = -1 ;
+struct timeval sim_start ;
+
+// The serial tx buffer, which the UART empties at serial_port_speed (10 bits a
+// byte), so the firmware sees the same room in it as on the rotator
+const double sim_tx_bytes_per_msec = serial_port_speed / 10000.0 ;
+double sim_tx_queued = 0 ;
+double sim_tx_msecs = 0 ;
+
+double sim_msecs()
+{
+  struct timeval now ;
+  gettimeofday(&now, NULL);
+  return ( now.tv_sec - sim_start.tv_sec ) * 1000.0 + ( now.tv_usec - sim_start.tv_usec ) / 1000.0 ;
+}
+
+unsigned long millis()
+{
+  return (unsigned long)sim_msecs() * millis_correction ; // as the real timer 0 runs fast
+}
+
+// Bytes still in the tx buffer now
+double sim_tx_drain()
+{
+  double now = sim_msecs() ;
+  sim_tx_queued = max(0.0, sim_tx_queued - ( now - sim_tx_msecs ) * sim_tx_bytes_per_msec) ;
+  sim_tx_msecs = now ;
+  return sim_tx_queued ;
+}
+
+void delay(unsigned long ms)
+{
+  usleep(ms * 1000 / millis_correction);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {}
+
+void HostSerial::begin(long speed) {}
+
+// Waits for room in the tx buffer, as the AVR core does
+size_t HostSerial::write(const byte * buf, size_t len)
+{
+  double over = sim_tx_drain() + len - ( SERIAL_TX_BUFFER_SIZE - 1 ) ;
+  if ( over > 0 )
+    usleep(over * 1000 / sim_tx_bytes_per_msec);
+  sim_tx_drain();
+  sim_tx_queued += len ;
+
+  ssize_t sent = ::write(sim_pty, buf, len);
+  return sent < 0 ? 0 : sent ;
+}
+
+int HostSerial::availableForWrite()
+{
+  return SERIAL_TX_BUFFER_SIZE - 1 - (int)ceil(sim_tx_drain()) ;
+}
+
+int HostSerial::available()
+{
+  int count = 0 ;
+  if ( ioctl(sim_pty, FIONREAD, &count) < 0 )
+    return 0 ;
+  return count ;
+}
+
+int HostSerial::read()
+{
+  byte value ;
+  return ::read(sim_pty, &value, 1) == 1 ? value : -1 ;
+}
+
+size_t HostSerial::print(long value)
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%ld", value);
+  return print(buf);
+}
+
+int main(int argc, char ** argv)
+{
+  const char * link = NULL ;
+
+  for ( int i = 1 ; i + 1 < argc ; i += 2 )
+  {
+    if ( strcmp(argv[i], "--address") == 0 )
+      EEPROM.write(eeprom_multidrop_address, atoi(argv[i+1]));
+    else if ( strcmp(argv[i], "--heading") == 0 )
+      sim_heading = atof(argv[i+1]);
+    else if ( strcmp(argv[i], "--jam") == 0 )
+      sim_az_jammed = atoi(argv[i+1]);
+    else if ( strcmp(argv[i], "--backlash") == 0 )
+      sim_backlash_degrees = atof(argv[i+1]);
+    else if ( strcmp(argv[i], "--interference") == 0 )
+      sim_interference_ut = atof(argv[i+1]);
+    else if ( strcmp(argv[i], "--link") == 0 )
+      link = argv[i+1];
+    else
+    {
+      fprintf(stderr, "usage: %s [--address <n>] [--heading <degrees>] [--jam <0|1>] [--backlash <degrees>] [--interference <uT>] [--link <path>]\n", argv[0]);
+      return 2 ;
+    }
+  }
+
+  // Raw pty, so binary protocols pass through untouched
+  sim_pty = posix_openpt(O_RDWR | O_NOCTTY);
+  if ( sim_pty < 0 || grantpt(sim_pty) < 0 || unlockpt(sim_pty) < 0 )
+  {
+    perror("pty");
+    return 1 ;
+  }
+  struct termios tio ;
+  int port = open(ptsname(sim_pty), O_RDWR | O_NOCTTY);
+  tcgetattr(port, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(port, TCSANOW, &tio);
+  close(port);
+
+  if ( link )
+  {
+    unlink(link);
+    if ( symlink(ptsname(sim_pty), link) < 0 )
+      perror(link);
+  }
+  printf("%s\n", ptsname(sim_pty));
+  fflush(stdout);
+
+  gettimeofday(&sim_start, NULL);
+  setup();
+  for (;;)
+  {
+    loop();
+    usleep(1000); // about the loop rate of the real rotator
+  }
+}
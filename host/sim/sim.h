@@ -0,0 +1,9 @@
+// Shared values between the rotator simulation and its hardware stand-ins
+// rototor_areg
+// VK5CD
+
+extern float sim_heading ;
+extern float sim_pitch ;
+extern bool sim_az_jammed ;
+extern float sim_backlash_degrees ;
+extern float sim_interference_ut ;
@@ -0,0 +1,204 @@
+// Host simulation of the rotator hardware
+// rototor_areg
+// VK5CD
+//
+// Stands in for ahrs_sensors.cpp, motors.cpp, memory.cpp and power.cpp with a simple
+// model of the rotator: each axis has a motor deadband, then moves at a rate
+// proportional to its motor pwm, getting up to (or down from) that rate with
+// a time constant for its inertia. Optionally the gears have backlash, so after
+// a reversal the motor turns that far before the axis moves. The sensors return
+// the raw values for the modelled orientation, optionally disturbed by the motor
+// currents, with a glitch as each motor starts, stops or reverses.
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "ahrs.h"
+#include "motors.h"
+#include "memory.h"
+#include "power.h"
+#include "sim.h"
+#include "rotator.h"
+#include "magcal.h"
+
+// Full pwm slew rates of the modelled rotator
+const float sim_az_degrees_per_sec = 6.0F ;
+const float sim_el_degrees_per_sec = 3.0F ;
+const int sim_deadband_pwm = 30 ;         // motors don't turn below this
+const float sim_time_constant_secs = 0.2F ;
+const float sim_stiction_degrees_per_sec = 0.1F ; // coasting slower than this stops
+
+// Field strengths used for the raw sensor values
+const float sim_gravity = 981.0F ;      // 0.01 m/s^2
+const float sim_mag_horizontal = 200.0F ; // 0.1 uT
+const float sim_mag_vertical = -400.0F ;
+
+// Magnetometer disturbance with each motor at full pwm, as a fraction of
+// sim_interference_ut, and how long the glitch as a motor changes lasts
+const float sim_az_interference[3] = { 1.0F, 0.5F, 0.0F } ;
+const float sim_el_interference[3] = { -0.5F, 1.0F, 0.3F } ;
+const unsigned long sim_glitch_msecs = 50 ;
+
+float sim_heading = 0 ; // degrees, 0 north, positive clockwise
+float sim_pitch = 0 ;   // degrees, 0 level
+bool sim_az_jammed = false ;
+float sim_backlash_degrees = 0 ;
+float sim_az_play = 0 ; // motor position less the axis, +/- half the backlash
+float sim_el_play = 0 ;
+float sim_interference_ut = 0 ;
+unsigned long sim_glitch_start = 0 ; // last time a motor started, stopped or reversed
+int sim_az_pwm = 0 ;
+int sim_el_pwm = 0 ;
+float sim_az_rate = 0 ; // degrees/sec
+float sim_el_rate = 0 ;
+unsigned long sim_last_msecs = 0 ;
+
+// Steady rate for a pwm, degrees/sec
+float sim_rate(int pwm, float degrees_per_sec)
+{
+  if ( abs(pwm) <= sim_deadband_pwm )
+    return 0 ;
+  float rate = ( abs(pwm) - sim_deadband_pwm ) / float(255 - sim_deadband_pwm) * degrees_per_sec ;
+  return pwm > 0 ? rate : - rate ;
+}
+
+// How far the axis moves when its motor turns, taking up the backlash first
+float sim_gears(float motor_degrees, float * play)
+{
+  float half = sim_backlash_degrees / 2 ;
+  float moved = 0 ;
+
+  *play += motor_degrees ;
+  if ( *play > half )
+  {
+    moved = *play - half ;
+    *play = half ;
+  }
+  else if ( *play < - half )
+  {
+    moved = *play + half ;
+    *play = - half ;
+  }
+  return moved ;
+}
+
+// Move the model on to now
+void sim_move()
+{
+  unsigned long now = millis() / millis_correction ;
+  float secs = ( now - sim_last_msecs ) / 1000.0F ;
+  float change = fmin(secs / sim_time_constant_secs, 1.0F) ;
+  sim_last_msecs = now ;
+
+  sim_az_rate += ( sim_rate(sim_az_pwm, sim_az_degrees_per_sec) - sim_az_rate ) * change ;
+  sim_el_rate += ( sim_rate(sim_el_pwm, sim_el_degrees_per_sec) - sim_el_rate ) * change ;
+
+  // Otherwise the rate only ever decays towards 0, and the creep shows up
+  // once in a while as the raw sensor values step
+  if ( sim_az_pwm == 0 && fabs(sim_az_rate) < sim_stiction_degrees_per_sec )
+    sim_az_rate = 0 ;
+  if ( sim_el_pwm == 0 && fabs(sim_el_rate) < sim_stiction_degrees_per_sec )
+    sim_el_rate = 0 ;
+  if ( sim_az_jammed )
+    sim_az_rate = 0 ;
+
+  sim_heading += sim_gears(sim_az_rate * secs, &sim_az_play) ;
+  while ( sim_heading > 180 ) sim_heading -= 360 ;
+  while ( sim_heading < -180 ) sim_heading += 360 ;
+  sim_pitch += sim_gears(sim_el_rate * secs, &sim_el_play) ;
+}
+
+void ahrs_setup()
+{
+}
+
+// Raw values that give the modelled orientation, with the sensor level in
+// roll so get_orientation() heading = 180 - atan2(-mag y, horizontal mag)
+void ahrs_read_raw(ahrs_raw_values * raw)
+{
+  sim_move();
+
+  float pitch = sim_pitch * M_PI / 180 ;
+  float ahrs_heading = ( 180 - sim_heading ) * M_PI / 180 ;
+  float mag_x = ( sim_mag_horizontal * cos(ahrs_heading) - sim_mag_vertical * sin(pitch) ) / cos(pitch) ;
+
+  raw->accel[0] = round( - sim_gravity * sin(pitch) ) ;
+  raw->accel[1] = 0 ;
+  raw->accel[2] = round( sim_gravity * cos(pitch) ) ;
+  raw->mag[0] = round( mag_x ) ;
+  raw->mag[1] = round( - sim_mag_horizontal * sin(ahrs_heading) ) ;
+  raw->mag[2] = round( sim_mag_vertical ) ;
+
+  // Motor currents, in 0.1 uT like the raw values, doubled through a glitch
+  if ( sim_interference_ut != 0 )
+  {
+    float scale = sim_interference_ut * 10 / 255 ;
+    if ( sim_last_msecs - sim_glitch_start < sim_glitch_msecs )
+      scale *= 2 ;
+    for ( byte i = 0 ; i < 3 ; i++ )
+      raw->mag[i] += round( ( sim_az_interference[i] * sim_az_pwm + sim_el_interference[i] * sim_el_pwm ) * scale ) ;
+  }
+
+  // Then as the hardware does
+  magcal_compensate(raw->mag);
+}
+
+void ahrs_set_low_power(bool low_power)
+{
+}
+
+void motors_setup()
+{
+}
+
+void set_el_motor_pwm_speed(int pwm_speed)
+{
+  sim_move();
+  if ( ( pwm_speed > 0 ) != ( sim_el_pwm > 0 ) || ( pwm_speed < 0 ) != ( sim_el_pwm < 0 ) )
+    sim_glitch_start = sim_last_msecs ;
+  sim_el_pwm = pwm_speed ;
+  magcal_motor_pwm(rotator_axis_el, pwm_speed);
+}
+
+void set_az_motor_pwm_speed(int pwm_speed)
+{
+  sim_move();
+  if ( ( pwm_speed > 0 ) != ( sim_az_pwm > 0 ) || ( pwm_speed < 0 ) != ( sim_az_pwm < 0 ) )
+    sim_glitch_start = sim_last_msecs ;
+  sim_az_pwm = pwm_speed ;
+  magcal_motor_pwm(rotator_axis_az, pwm_speed);
+}
+
+unsigned int memory_stack_free_min()
+{
+  return 0 ;
+}
+
+unsigned int memory_free_now()
+{
+  return 0 ;
+}
+
+// No MCU sleep on the host, the sim loop always sleeps between iterations,
+// but do count how many loops were idle so the duty cycle can be checked
+unsigned long sim_loops = 0 ;
+unsigned long sim_idle_loops = 0 ;
+
+void power_setup()
+{
+}
+
+void power_update(bool can_sleep)
+{
+  sim_loops ++ ;
+  if ( can_sleep )
+    sim_idle_loops ++ ;
+}
+
+unsigned int power_awake_permille()
+{
+  unsigned int permille = sim_loops ? 1000 - sim_idle_loops * 1000 / sim_loops : 1000 ;
+  sim_loops = 0 ;
+  sim_idle_loops = 0 ;
+  return permille ;
+}
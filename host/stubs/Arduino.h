@@ -0,0 +1,75 @@
+// Minimal host stand-in for the Arduino core, just enough for the host builds
+// rototor_areg
+// VK5CD
+//
+// Only provides what the hardware independent rotator code uses. Each host
+// build (replay/, sim/) implements the functions and Serial port to suit,
+// along with stand-ins for the hardware facing files it leaves out.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+
+// Same as the AVR core, works for both int and float
+#ifdef abs
+#undef abs
+#endif
+#define abs(x) ((x)>0?(x):-(x))
+
+// As the AVR core macros, without breaking the host C++ library headers
+template <typename T, typename U> T min(T a, U b) { return a < b ? a : T(b); }
+template <typename T, typename U> T max(T a, U b) { return a > b ? a : T(b); }
+template <typename T, typename U, typename V> T constrain(T x, U low, V high) { return x < low ? T(low) : x > high ? T(high) : x; }
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define _BV(bit) (1 << (bit))
+
+// Host data is all in the one address space
+#define PROGMEM
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define memcpy_P memcpy
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+
+unsigned long millis();
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+// UART status, as checked for transmit complete
+extern uint8_t UCSR0A;
+#define TXC0 6
+#define SERIAL_TX_BUFFER_SIZE 64
+
+class HostSerial
+{
+  public:
+    void begin(long speed);
+    size_t write(byte value) { return write(&value, 1); }
+    size_t write(const char * buf, size_t len) { return write((const byte *)buf, len); }
+    size_t write(const byte * buf, size_t len);
+    int availableForWrite();
+    int available();
+    int read();
+
+    size_t print(const char * str) { return write(str, strlen(str)); }
+    size_t print(const __FlashStringHelper * str) { return print(reinterpret_cast<const char *>(str)); }
+    size_t print(long value);
+    size_t println() { return write('\n'); }
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+};
+
+extern HostSerial Serial;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,25 @@
+// Host stand-in for the Arduino EEPROM library
+// rototor_areg
+// VK5CD
+
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <Arduino.h>
+
+class EEPROMClass
+{
+  public:
+    uint8_t data[1024];
+
+    EEPROMClass() { memset(data, 0xFF, sizeof(data)); } // erased
+    uint8_t read(int address) { return data[address]; }
+    void write(int address, uint8_t value) { data[address] = value; }
+    void update(int address, uint8_t value) { data[address] = value; }
+    template <typename T> T & get(int address, T & value) { memcpy(&value, &data[address], sizeof(T)); return value; }
+    template <typename T> const T & put(int address, const T & value) { memcpy(&data[address], &value, sizeof(T)); return value; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // HOST_EEPROM_H
@@ -0,0 +1,19 @@
+// Host stand-in for avr-libc util/crc16.h
+// rototor_areg
+// VK5CD
+
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+// CRC-CCITT polynomial 0x1021, same result as the avr-libc version
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+  crc ^= (uint16_t)data << 8;
+  for ( int i = 0 ; i < 8 ; i++ )
+    crc = crc & 0x8000 ? ( crc << 1 ) ^ 0x1021 : crc << 1;
+  return crc;
+}
+
+#endif // HOST_UTIL_CRC16_H
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+#
+# Cycle accurate benchmark of the rotator firmware, with regression check
+#
+# Runs the simavr benchmark (host/bench/bench.cpp) on each scenario and
+# writes the combined CSV (cycles per call and stack depth of each measured
+# function). With --baseline, compares against the CSV from an earlier run
+# and exits non zero if any function got slower or used more stack by more
+# than the threshold.
+#
+#   pio run -e uno && pio run -e bench
+#   python3 bench.py -o baseline.csv
+#   ... change the firmware and rebuild ...
+#   python3 bench.py --baseline baseline.csv
+#
+# The cycle counts only depend on the firmware and scenarios, so any change
+# is real, but compare like with like (same scenarios, same compiler).
+# VK5CD
+
+import argparse, csv, glob, io, os, subprocess, sys
+
+FIELDS = ['scenario', 'function', 'calls', 'min_cycles', 'avg_cycles', 'max_cycles', 'max_stack']
+# Compared against the baseline, the rest are just reported
+CHECKED = ['avg_cycles', 'max_cycles', 'max_stack']
+
+
+def run_scenario(bench, elf, scenario, functions):
+    cmd = [bench, '--csv'] + sum([['--function', f] for f in functions], []) + [elf, scenario]
+    output = subprocess.check_output(cmd, universal_newlines=True)
+    return list(csv.DictReader(io.StringIO(output)))
+
+
+def read_csv(path):
+    with open(path) as f:
+        return {(row['scenario'], row['function']): row for row in csv.DictReader(f)}
+
+
+def compare(rows, baseline, threshold):
+    """Print each change beyond the threshold, returning the number of regressions"""
+    regressions = 0
+    for row in rows:
+        old = baseline.get((row['scenario'], row['function']))
+        if old is None:
+            print('new: %s %s' % (row['scenario'], row['function']), file=sys.stderr)
+            continue
+        for field in CHECKED:
+            before, after = int(old[field]), int(row[field])
+            change = 100.0 * (after - before) / before if before else (100.0 if after else 0.0)
+            if abs(change) > threshold:
+                worse = change > 0
+                regressions += worse
+                print('%s %s %s %s: %d -> %d (%+.1f%%)' % ('REGRESSION' if worse else 'improved  ',
+                      row['scenario'], row['function'], field, before, after, change), file=sys.stderr)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Cycle accurate benchmark of the rotator firmware')
+    parser.add_argument('--bench', default='.pio/build/bench/program')
+    parser.add_argument('--elf', default='.pio/build/uno/firmware.elf')
+    parser.add_argument('--function', action='append', default=[], help='measure another function')
+    parser.add_argument('-o', '--output', help='save the combined CSV here (default stdout)')
+    parser.add_argument('--baseline', help='CSV from an earlier run to compare against')
+    parser.add_argument('--threshold', type=float, default=2.0, help='percent change allowed (default 2)')
+    parser.add_argument('scenarios', nargs='*', help='default host/bench/scenarios/*.txt')
+    args = parser.parse_args()
+
+    scenarios = args.scenarios or sorted(glob.glob(os.path.join('host', 'bench', 'scenarios', '*.txt')))
+    rows = []
+    for scenario in scenarios:
+        rows += run_scenario(args.bench, args.elf, scenario, args.function)
+
+    out = open(args.output, 'w', newline='') if args.output else sys.stdout
+    writer = csv.DictWriter(out, FIELDS, lineterminator='\n')
+    writer.writeheader()
+    writer.writerows(rows)
+    if args.output:
+        out.close()
+
+    if args.baseline:
+        regressions = compare(rows, read_csv(args.baseline), args.threshold)
+        print('%d regressions over %.1f%%' % (regressions, args.threshold), file=sys.stderr)
+        return 1 if regressions else 0
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
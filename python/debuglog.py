@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+#
+# Show the rotator's binary debug log as text
+#
+# The rotator logs debug events into a RAM ring (see src/debuglog.h) and only
+# sends the event IDs and arguments, the text for each event is here. Either
+# streams events as they are logged ('l1' cmd) until Ctrl-C (or --seconds),
+# sends the last events logged once ('l' cmd, e.g. after a fault) with --dump,
+# or decodes the log records in a file saved by trace_capture.py.
+#
+# Examples
+#   python3 debuglog.py -p /dev/ttyACM0
+#   python3 debuglog.py -p /dev/ttyACM0 --dump
+#   python3 debuglog.py --decode run1.trace
+# VK5CD
+
+import argparse, struct, time
+
+from trace_capture import extract_records, TYPE_LOG
+
+# Must match src/debuglog.h
+RECORD_FORMAT = '<BH3hB'
+EVENTS = {
+    1: 'heading error {0}: rejected {1} kept {2}',
+    2: 'el ramp: wanted {0} from pwm {1} change {2}',
+    3: 'el ramp done: pwm {0} pitch {1} target {2}',
+    4: 'az ramp: wanted {0} from pwm {1} change {2}',
+    5: 'az ramp done: pwm {0} heading {1} target {2}',
+    6: 'fault {0}: heading {1} pitch {2}',
+    7: 'identify {1}: {0}',
+    8: 'magcal {1}: {0} ({2} pulses rejected as the axis moved)',
+}
+# Names for the first argument of some events, must match src/fault.h,
+# src/tuning.h and src/magcal.h
+AXES = {0: 'az', 1: 'el'}
+NAMES = {
+    6: ({1: 'az stall', 2: 'az reversed', 3: 'az runaway',
+         4: 'el stall', 5: 'el reversed', 6: 'el runaway'}, None),
+    7: ({2: 'done', 3: 'aborted', 4: 'failed, no movement',
+         5: 'failed, not enough travel or no movement'}, AXES),
+    8: ({2: 'done', 3: 'aborted', 4: 'done, some offsets clipped', 5: 'failed, axis kept moving', 6: 'failed, deadband not known'}, AXES),
+}
+
+
+class Decoder:
+    """Turns log record payloads into lines of text, unwrapping the 16 bit msecs"""
+
+    def __init__(self):
+        self.msecs = None
+
+    def line(self, payload):
+        if len(payload) != struct.calcsize(RECORD_FORMAT):
+            return None
+        event, msecs, a, b, c, lost = struct.unpack(RECORD_FORMAT, payload)
+        if self.msecs is None:
+            self.msecs = msecs
+        else:
+            self.msecs += (msecs - self.msecs) & 0xffff
+        args = [a, b, c]
+        for i, names in enumerate(NAMES.get(event, ())):
+            if names:
+                args[i] = names.get(args[i], args[i])
+        text = EVENTS.get(event, 'event %d: {0} {1} {2}' % event).format(*args)
+        if lost:
+            text = '(%s lost) %s' % ('255+' if lost == 255 else lost, text)
+        return '%10.3f %s' % (self.msecs / 1000.0, text)
+
+
+def show(records, decoder):
+    for rtype, payload, _ in records:
+        if rtype == TYPE_LOG:
+            line = decoder.line(payload)
+            if line:
+                print(line, flush=True)
+
+
+def stream(args):
+    import serial
+    ser = serial.Serial(port=args.port, baudrate=args.speed, timeout=0.1)
+    time.sleep(2)  # Uno resets when port opened
+    ser.reset_input_buffer()
+    ser.write(b'l\n' if args.dump else b'l1\n')
+
+    decoder = Decoder()
+    buf = bytearray()
+    start = time.time()
+    seconds = args.seconds or (2 if args.dump else 0)
+    try:
+        while seconds == 0 or time.time() - start < seconds:
+            buf += ser.read(4096)
+            records, buf = extract_records(buf)
+            show(records, decoder)
+    except KeyboardInterrupt:
+        pass
+    if not args.dump:
+        ser.write(b'l0\n')
+
+
+def decode(args):
+    with open(args.decode, 'rb') as f:
+        records, _ = extract_records(bytearray(f.read()))
+    show(records, Decoder())
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Show the rotator_areg binary debug log')
+    parser.add_argument('-p', '--port', default='/dev/ttyACM0')
+    parser.add_argument('-s', '--speed', type=int, default=115200)
+    parser.add_argument('-t', '--seconds', type=float, default=0, help='0 = until Ctrl-C')
+    parser.add_argument('--dump', action='store_true', help='just the last events logged')
+    parser.add_argument('--decode', metavar='TRACE', help='show the log records in a captured trace')
+    args = parser.parse_args()
+
+    if args.decode:
+        decode(args)
+    else:
+        stream(args)
@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+#
+# Check the rotator's sun/moon positions against a more accurate reference
+#
+# Starts a host simulated rotator (host/sim, running the real fixed point
+# ephemeris code), and for a range of sites and times over several decades
+# sets the site and time with the CLI 'k' cmds and compares the sun and moon
+# positions it reports against the reference here, which follows Meeus,
+# Astronomical Algorithms (sun to 0.01 degrees, moon with the main terms of
+# chapter 47 and full topocentric parallax, good to better than 0.01 degrees).
+#
+#   pio run -e sim
+#   python3 ephemeris_check.py [--sim .pio/build/sim/program] [--count 500]
+#
+# Exits non zero if any position is further off than the limits below. Both
+# are geometric positions (no refraction), and are compared as the angle
+# between them, so azimuth errors near the zenith don't count for more than
+# they are.
+# VK5CD
+
+import argparse, math, os, random, select, subprocess, sys, time
+
+import rotctld
+
+J2000_UNIX = 946728000
+SUN_LIMIT = 0.1   # degrees
+MOON_LIMIT = 0.5
+
+# Sites, latitude and longitude in degrees
+SITES = [(-34.929, 138.601), (51.4779, -0.0015), (40.7128, -74.006), (-77.846, 166.676),
+         (64.1466, -21.9426), (0.0, 0.0), (35.6762, 139.6503), (-33.9249, 18.4241)]
+
+
+def sin(x):
+    return math.sin(math.radians(x))
+
+
+def cos(x):
+    return math.cos(math.radians(x))
+
+
+def sun_ecliptic(t):
+    """Apparent longitude, latitude (degrees) and distance (earth radii), t in Julian centuries"""
+    l0 = 280.46646 + 36000.76983 * t + 0.0003032 * t * t
+    m = 357.52911 + 35999.05029 * t - 0.0001537 * t * t
+    c = ((1.914602 - 0.004817 * t - 0.000014 * t * t) * sin(m)
+         + (0.019993 - 0.000101 * t) * sin(2 * m) + 0.000289 * sin(3 * m))
+    omega = 125.04 - 1934.136 * t
+    return l0 + c - 0.00569 - 0.00478 * sin(omega), 0.0, 23455.0
+
+
+# Meeus table 47.A, D M M' F, longitude (1e-6 degrees), distance (1e-3 km)
+MOON_LR = [
+    (0, 0, 1, 0, 6288774, -20905355), (2, 0, -1, 0, 1274027, -3699111), (2, 0, 0, 0, 658314, -2955968),
+    (0, 0, 2, 0, 213618, -569925), (0, 1, 0, 0, -185116, 48888), (0, 0, 0, 2, -114332, -3149),
+    (2, 0, -2, 0, 58793, 246158), (2, -1, -1, 0, 57066, -152138), (2, 0, 1, 0, 53322, -170733),
+    (2, -1, 0, 0, 45758, -204586), (0, 1, -1, 0, -40923, -129620), (1, 0, 0, 0, -34720, 108743),
+    (0, 1, 1, 0, -30383, 104755), (2, 0, 0, -2, 15327, 10321), (0, 0, 1, 2, -12528, 0),
+    (0, 0, 1, -2, 10980, 79661), (4, 0, -1, 0, 10675, -34782), (0, 0, 3, 0, 10034, -23210),
+    (4, 0, -2, 0, 8548, -21636), (2, 1, -1, 0, -7888, 24208), (2, 1, 0, 0, -6766, 30824),
+    (1, 0, -1, 0, -5163, -8379), (1, 1, 0, 0, 4987, -16675), (2, -1, 1, 0, 4036, -12831),
+    (2, 0, 2, 0, 3994, -10445), (4, 0, 0, 0, 3861, -11650), (2, 0, -3, 0, 3665, 14403),
+    (0, 1, -2, 0, -2689, -7003), (2, 0, -1, 2, -2602, 0), (2, -1, -2, 0, 2390, 10056),
+    (1, 0, 1, 0, -2348, 6322), (2, -2, 0, 0, 2236, -9884), (0, 1, 2, 0, -2120, 5751),
+    (0, 2, 0, 0, -2069, 0),
+]
+
+# Meeus table 47.B, D M M' F, latitude (1e-6 degrees)
+MOON_B = [
+    (0, 0, 0, 1, 5128122), (0, 0, 1, 1, 280602), (0, 0, 1, -1, 277693), (2, 0, 0, -1, 173237),
+    (2, 0, -1, 1, 55413), (2, 0, -1, -1, 46271), (2, 0, 0, 1, 32573), (0, 0, 2, 1, 17198),
+    (2, 0, 1, -1, 9266), (0, 0, 2, -1, 8822), (2, -1, 0, -1, 8216), (2, 0, -2, -1, 4324),
+    (2, 0, 1, 1, 4200), (2, 1, 0, -1, -3359), (2, -1, -1, 1, 2463), (2, -1, 0, 1, 2211),
+    (2, -1, -1, -1, 2065), (0, 1, -1, -1, -1870), (4, 0, -1, -1, 1828), (0, 1, 0, 1, -1794),
+    (0, 0, 0, 3, -1749),
+]
+
+
+def moon_ecliptic(t):
+    """Longitude, latitude (degrees) and distance (earth radii), t in Julian centuries"""
+    lp = 218.3164477 + 481267.88123421 * t
+    d = 297.8501921 + 445267.1114034 * t
+    m = 357.5291092 + 35999.0502909 * t
+    mp = 134.9633964 + 477198.8675055 * t
+    f = 93.2720950 + 483202.0175233 * t
+    a1 = 119.75 + 131.849 * t
+    a2 = 53.09 + 479264.290 * t
+    a3 = 313.45 + 481266.484 * t
+    e = 1 - 0.002516 * t
+    sl = sr = sb = 0.0
+    for cd, cm, cmp, cf, l, r in MOON_LR:
+        arg = cd * d + cm * m + cmp * mp + cf * f
+        scale = e ** abs(cm)
+        sl += l * scale * sin(arg)
+        sr += r * scale * cos(arg)
+    for cd, cm, cmp, cf, b in MOON_B:
+        sb += b * e ** abs(cm) * sin(cd * d + cm * m + cmp * mp + cf * f)
+    sl += 3958 * sin(a1) + 1962 * sin(lp - f) + 318 * sin(a2)
+    sb += (-2235 * sin(lp) + 382 * sin(a3) + 175 * sin(a1 - f) + 175 * sin(a1 + f)
+           + 127 * sin(lp - mp) - 115 * sin(lp + mp))
+    return lp + sl / 1e6, sb / 1e6, (385000.56 + sr / 1000) / 6378.14
+
+
+def reference_position(body, unix_secs, latitude, longitude):
+    """Topocentric azimuth (0 north, clockwise) and elevation in degrees"""
+    days = (unix_secs - J2000_UNIX) / 86400.0
+    t = days / 36525
+    lon, lat, distance = (sun_ecliptic if body == 'sun' else moon_ecliptic)(t)
+    obliquity = 23.439291 - 0.0130042 * t + 0.00256 * cos(125.04 - 1934.136 * t)
+
+    # Geocentric equatorial vector, earth radii
+    x = distance * cos(lat) * cos(lon)
+    y = distance * (cos(lat) * sin(lon) * cos(obliquity) - sin(lat) * sin(obliquity))
+    z = distance * (cos(lat) * sin(lon) * sin(obliquity) + sin(lat) * cos(obliquity))
+
+    # Less the observer's position (spherical earth)
+    sidereal = 280.46061837 + 360.98564736629 * days + 0.000387933 * t * t + longitude
+    x -= cos(latitude) * cos(sidereal)
+    y -= cos(latitude) * sin(sidereal)
+    z -= sin(latitude)
+
+    # Horizon
+    x_ha = x * cos(sidereal) + y * sin(sidereal)
+    east = y * cos(sidereal) - x * sin(sidereal)
+    north = z * cos(latitude) - x_ha * sin(latitude)
+    up = z * sin(latitude) + x_ha * cos(latitude)
+    azimuth = math.degrees(math.atan2(east, north)) % 360
+    elevation = math.degrees(math.atan2(up, math.hypot(east, north)))
+    return azimuth, elevation
+
+
+def separation(a, b):
+    """Angle between two (azimuth, elevation) in degrees"""
+    c = sin(a[1]) * sin(b[1]) + cos(a[1]) * cos(b[1]) * cos(a[0] - b[0])
+    return math.degrees(math.acos(max(-1.0, min(1.0, c))))
+
+
+class Rotator:
+    """CLI on the simulated rotator's pty"""
+
+    def __init__(self, path):
+        self.fd = rotctld.open_serial(path)
+        self.buf = b''
+
+    def command(self, text, reply):
+        """Send a CLI cmd, returning the first line starting with reply"""
+        os.write(self.fd, (text + '\n').encode('ascii'))
+        until = time.time() + 2
+        while time.time() < until:
+            while b'\n' in self.buf:
+                line, self.buf = self.buf.split(b'\n', 1)
+                line = line.decode('ascii', 'replace').strip()
+                if line.startswith(reply):
+                    return line
+            if select.select([self.fd], [], [], 0.1)[0]:
+                self.buf += os.read(self.fd, 1024)
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Check the rotator sun/moon positions against a reference')
+    parser.add_argument('--sim', default='.pio/build/sim/program')
+    parser.add_argument('--count', type=int, default=500, help='number of times to check at')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    sim = subprocess.Popen([args.sim], stdout=subprocess.PIPE, universal_newlines=True)
+    worst = {'sun': 0.0, 'moon': 0.0}
+    worst_el = {'sun': 0.0, 'moon': 0.0}
+    try:
+        rotator = Rotator(sim.stdout.readline().strip())
+        for i in range(args.count):
+            latitude, longitude = SITES[i % len(SITES)]
+            unix_secs = random.randint(1577836800, 2208988800)  # 2020 to 2040
+            rotator.command('kl%.3f,%.3f' % (latitude, longitude), 'track:')
+            line = rotator.command('ku%d' % unix_secs, 'track:').split()
+            reported = int(line[3])
+            positions = {'sun': line[line.index('sun') + 1:][:2], 'moon': line[line.index('moon') + 1:][:2]}
+            for body, (az, el) in positions.items():
+                rotator_position = (int(az) / 10.0, int(el) / 10.0)
+                reference = reference_position(body, reported, latitude, longitude)
+                error = separation(rotator_position, reference)
+                worst[body] = max(worst[body], error)
+                worst_el[body] = max(worst_el[body], abs(rotator_position[1] - reference[1]))
+                if error > (SUN_LIMIT if body == 'sun' else MOON_LIMIT):
+                    print('%s at %d from %.3f,%.3f: rotator %.1f %.1f reference %.2f %.2f, off by %.2f degrees'
+                          % (body, reported, latitude, longitude, rotator_position[0], rotator_position[1],
+                             reference[0], reference[1], error))
+    finally:
+        sim.kill()
+
+    for body, limit in (('sun', SUN_LIMIT), ('moon', MOON_LIMIT)):
+        print('%s: worst %.3f degrees (elevation %.3f), limit %.1f over %d times'
+              % (body, worst[body], worst_el[body], limit, args.count))
+    return 1 if worst['sun'] > SUN_LIMIT or worst['moon'] > MOON_LIMIT else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+#
+# Per-symbol RAM/flash memory report for the rotator firmware
+#
+# Runs as a PlatformIO extra script (see platformio.ini), which after each
+# build writes the full report to .pio/build/<env>/memory_report.txt and
+# prints the totals, and adds a target to print the full report with
+#   pio run -e uno -t memreport
+#
+# Can also be run directly on any AVR firmware.elf
+#   python3 memory_report.py .pio/build/uno/firmware.elf
+#
+# Static RAM is only part of the story, the stack uses what is left. Use the
+# CLI 'm' cmd on the running rotator to get the stack high-water mark.
+# VK5CD
+
+import argparse, subprocess
+
+# ATmega328P, flash less the Uno bootloader
+RAM_SIZE = 2048
+FLASH_SIZE = 32256
+# Static RAM use that leaves less than this for the stack gets a warning
+MIN_STACK = 256
+
+# AVR ELF address spaces
+RAM_BASE = 0x800000
+EEPROM_BASE = 0x810000
+
+
+def read_symbols(elf, nm):
+    """Return list of (size, section, name) for every sized symbol"""
+    out = subprocess.run([nm, '-C', '-S', '--size-sort', elf],
+                         check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4:
+            continue
+        addr, size, kind, name = int(parts[0], 16), int(parts[1], 16), parts[2], parts[3]
+        if addr >= EEPROM_BASE:
+            section = 'eeprom'
+        elif addr >= RAM_BASE:
+            section = 'data' if kind in 'dD' else 'bss'
+        else:
+            section = 'text'
+        symbols.append((size, section, name))
+    return symbols
+
+
+def report(elf, nm='avr-nm', ram_size=RAM_SIZE, flash_size=FLASH_SIZE, min_stack=MIN_STACK):
+    """Return (per symbol lines, totals lines)"""
+    symbols = read_symbols(elf, nm)
+    lines = []
+
+    for title, sections in (('RAM (.data + .bss)', ('data', 'bss')), ('Flash (.text, .data initialisers)', ('text', 'data'))):
+        lines.append(title)
+        lines.append('  %6s  %-6s  %s' % ('bytes', 'sect', 'symbol'))
+        for size, section, name in sorted(symbols, reverse=True):
+            if section in sections:
+                lines.append('  %6d  %-6s  %s' % (size, section, name))
+        lines.append('')
+
+    data = sum(s for s, sect, _ in symbols if sect == 'data')
+    bss = sum(s for s, sect, _ in symbols if sect == 'bss')
+    text = sum(s for s, sect, _ in symbols if sect == 'text')
+    ram = data + bss
+    flash = text + data
+    totals = ['RAM: %d bytes static (%d data, %d bss) of %d, %.1f%%, %d left for stack' %
+              (ram, data, bss, ram_size, 100.0 * ram / ram_size, ram_size - ram),
+              'Flash: %d bytes of %d, %.1f%% (symbols only, excludes vectors/padding)' %
+              (flash, flash_size, 100.0 * flash / flash_size)]
+    if ram_size - ram < min_stack:
+        totals.append('WARNING: less than %d bytes left for the stack' % min_stack)
+
+    return lines, totals
+
+
+try:
+    Import('env')  # noqa: F821 - provided when run as a PlatformIO extra script
+except NameError:
+    env = None
+
+if env is not None:
+    import os
+
+    # Use the nm from the same toolchain as the build
+    pio_nm = os.path.join(env.PioPlatform().get_package_dir('toolchain-atmelavr'), 'bin', 'avr-nm')
+
+    def memory_report_file(target, source, env):
+        elf = str(source[0])
+        lines, totals = report(elf, pio_nm)
+        with open(os.path.join(os.path.dirname(elf), 'memory_report.txt'), 'w') as f:
+            f.write('\n'.join(lines + totals) + '\n')
+        print('\n'.join(totals))
+
+    def memory_report_print(target, source, env):
+        lines, totals = report(str(source[0]), pio_nm)
+        print('\n'.join(lines + totals))
+
+    env.AddPostAction('$BUILD_DIR/${PROGNAME}.elf', memory_report_file)
+    env.AddCustomTarget(name='memreport', dependencies='$BUILD_DIR/${PROGNAME}.elf',
+                        actions=memory_report_print, title='Memory report',
+                        description='Per-symbol RAM/flash usage')
+
+elif __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Per-symbol RAM/flash report for an AVR elf')
+    parser.add_argument('elf')
+    parser.add_argument('--nm', default='avr-nm')
+    parser.add_argument('--ram-size', type=int, default=RAM_SIZE)
+    parser.add_argument('--flash-size', type=int, default=FLASH_SIZE)
+    parser.add_argument('--min-stack', type=int, default=MIN_STACK)
+    parser.add_argument('--summary', action='store_true', help='only print totals')
+    args = parser.parse_args()
+    lines, totals = report(args.elf, args.nm, args.ram_size, args.flash_size, args.min_stack)
+    print('\n'.join(totals if args.summary else lines + totals))
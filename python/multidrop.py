@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+#
+# Host side of the multi-drop binary protocol, for several rotators on one
+# serial bus (e.g. RS-485). See the protocol description in src/serial.cpp
+#
+# Can be used as a module (see multidrop_bus_test.py) or from the command line
+#   python3 multidrop.py -p /dev/ttyUSB0 status 3
+#   python3 multidrop.py -p /dev/ttyUSB0 target 3 90 30
+#   python3 multidrop.py -p /dev/ttyUSB0 stage 3 90 30
+#   python3 multidrop.py -p /dev/ttyUSB0 go          (all staged rotators move together)
+#   python3 multidrop.py -p /dev/ttyUSB0 estop       (emergency stop all)
+#   python3 multidrop.py -p /dev/ttyUSB0 poll 8      (all rotators with address 1..8)
+#   python3 multidrop.py -p /dev/ttyUSB0 clear 3     (clear a fault, targets are refused until then)
+#   python3 multidrop.py -p /dev/ttyUSB0 address 1 3 (change address 1 to 3, with only that rotator at 1)
+#   python3 multidrop.py -p /dev/ttyUSB0 address 3 0 (forget address 3, back to 1 with the CLI, off the bus)
+# VK5CD
+
+import argparse, collections, struct, time
+
+# Must match src/serial.cpp
+SOF = 0x7E
+BROADCAST = 0xFF
+DEFAULT_ADDRESS = 1  # until an address is saved, see src/config.h
+RESPONSE = 0x80
+MAX_PAYLOAD = 16
+SLOT_SECS = 0.010
+
+CMD_STATUS = 0x01
+CMD_SET_TARGET = 0x02
+CMD_STAGE_TARGET = 0x03
+CMD_GO = 0x04
+CMD_STOP = 0x05
+CMD_EMERGENCY_STOP = 0x06
+CMD_HOME = 0x07
+CMD_POLL = 0x08
+CMD_CLEAR_FAULT = 0x09
+CMD_SET_ADDRESS = 0x0A
+
+STATUS_STAGED = 0x01
+STATUS_FAULT = 0x02
+STATUS_IDLE = 0x04
+
+# Fault codes, must match src/fault.h
+FAULTS = {0: 'none', 1: 'az stall', 2: 'az reversed', 3: 'az runaway',
+          4: 'el stall', 5: 'el reversed', 6: 'el runaway'}
+
+Response = collections.namedtuple('Response', 'address cmd azimuth elevation status fault')
+
+
+def crc16(data):
+    """CRC-16/CCITT, polynomial 0x1021, initial 0xFFFF"""
+    crc = 0xFFFF
+    for x in data:
+        crc ^= x << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def encode_frame(address, cmd, payload=b''):
+    body = bytes([address, cmd, len(payload)]) + payload
+    return bytes([SOF]) + body + struct.pack('>H', crc16(body))
+
+
+def decode_frames(buf):
+    """Return (list of (address, cmd, payload), remaining buffer)"""
+    frames = []
+    pos = 0
+    while True:
+        pos = buf.find(bytes([SOF]), pos)
+        if pos < 0:
+            return frames, bytearray()
+        if pos + 4 > len(buf):
+            break
+        length = buf[pos + 3]
+        end = pos + 6 + length
+        if length > MAX_PAYLOAD:
+            pos += 1
+            continue
+        if end > len(buf):
+            break
+        body = bytes(buf[pos + 1:end - 2])
+        if crc16(body) == struct.unpack('>H', buf[end - 2:end])[0]:
+            frames.append((body[0], body[1], body[3:]))
+            pos = end
+        else:
+            pos += 1
+    return frames, buf[pos:]
+
+
+class MultidropBus:
+    """Talk to rotators on a bus, port is anything with read(n) and write(bytes),
+    e.g. a pyserial Serial with a short timeout"""
+
+    def __init__(self, port, timeout=0.2):
+        self.port = port
+        self.timeout = timeout
+        self.buf = bytearray()
+
+    def _responses(self, until, wanted=None):
+        """Collect responses until time, or until wanted of them received"""
+        responses = []
+        while time.time() < until and (wanted is None or len(responses) < wanted):
+            self.buf += self.port.read(64)
+            frames, self.buf = decode_frames(self.buf)
+            for address, cmd, payload in frames:
+                if cmd & RESPONSE and len(payload) == 6:
+                    az, el, status, fault = struct.unpack('<hhBB', payload)
+                    responses.append(Response(address, cmd & ~RESPONSE, az, el, status, fault))
+        return responses
+
+    def send(self, address, cmd, payload=b'', response_address=None):
+        """Send a cmd, returning the Response (None if none or broadcast)"""
+        self.buf = bytearray()
+        self.port.write(encode_frame(address, cmd, payload))
+        if address == BROADCAST:
+            return None
+        for response in self._responses(time.time() + self.timeout, 1):
+            if response.address == (response_address or address) and response.cmd == cmd:
+                return response
+        return None
+
+    def status(self, address):
+        return self.send(address, CMD_STATUS)
+
+    def set_target(self, address, azimuth, elevation):
+        return self.send(address, CMD_SET_TARGET, struct.pack('<hh', azimuth, elevation))
+
+    def stage_target(self, address, azimuth, elevation):
+        return self.send(address, CMD_STAGE_TARGET, struct.pack('<hh', azimuth, elevation))
+
+    def go(self, address=BROADCAST):
+        return self.send(address, CMD_GO)
+
+    def stop(self, address=BROADCAST):
+        return self.send(address, CMD_STOP)
+
+    def emergency_stop(self, address=BROADCAST):
+        return self.send(address, CMD_EMERGENCY_STOP)
+
+    def home(self, address=BROADCAST):
+        return self.send(address, CMD_HOME)
+
+    def clear_fault(self, address):
+        return self.send(address, CMD_CLEAR_FAULT)
+
+    def set_address(self, address, new_address):
+        """Change a rotator's address, only one rotator must have the current
+        address, the response comes from the new one. Address 0 forgets the
+        saved address, so the rotator answers the CLI again (off the bus)"""
+        return self.send(address, CMD_SET_ADDRESS, bytes([new_address]), new_address or DEFAULT_ADDRESS)
+
+    def poll(self, max_address):
+        """Broadcast poll, returns {address: Response} for every rotator that
+        answered in its slot, addresses 1..max_address"""
+        self.buf = bytearray()
+        self.port.write(encode_frame(BROADCAST, CMD_POLL))
+        until = time.time() + (max_address + 1) * SLOT_SECS + self.timeout
+        return {r.address: r for r in self._responses(until, max_address) if r.cmd == CMD_POLL}
+
+
+if __name__ == '__main__':
+    import serial
+
+    parser = argparse.ArgumentParser(description='Multi-drop rotator bus commands')
+    parser.add_argument('-p', '--port', default='/dev/ttyUSB0')
+    parser.add_argument('-s', '--speed', type=int, default=115200)
+    parser.add_argument('command', choices=['status', 'target', 'stage', 'go', 'stop', 'estop', 'home', 'poll', 'clear',
+                                            'address'])
+    parser.add_argument('args', nargs='*', type=int,
+                        help='address [azimuth elevation | new address], or max address for poll, '
+                             'broadcast if no address')
+    args = parser.parse_args()
+
+    bus = MultidropBus(serial.Serial(port=args.port, baudrate=args.speed, timeout=0.01))
+    address = args.args[0] if args.args else BROADCAST
+    if args.command == 'status':
+        print(bus.status(address))
+    elif args.command in ('target', 'stage'):
+        call = bus.set_target if args.command == 'target' else bus.stage_target
+        print(call(address, args.args[1], args.args[2]))
+    elif args.command == 'go':
+        print(bus.go(address))
+    elif args.command == 'stop':
+        print(bus.stop(address))
+    elif args.command == 'estop':
+        print(bus.emergency_stop(address))
+    elif args.command == 'home':
+        print(bus.home(address))
+    elif args.command == 'clear':
+        print(bus.clear_fault(address))
+    elif args.command == 'address':
+        print(bus.set_address(address, args.args[1]))
+    elif args.command == 'poll':
+        for response in sorted(bus.poll(args.args[0] if args.args else 16).values()):
+            print(response)
@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+#
+# Multi-drop protocol test with several simulated rotators on one bus
+#
+# Starts a number of host simulated rotators (host/sim, each on its own pty,
+# running the real firmware protocol code), joins them into one half duplex
+# bus like RS-485, and runs the host side (multidrop.py) against them. The
+# bus flags any two rotators transmitting at the same time as a collision.
+#
+#   pio run -e sim
+#   python3 multidrop_bus_test.py [--sim .pio/build/sim/program] [--count 4]
+#
+# Then checks setting one rotator's address, that the rotators ignore the CLI
+# on the bus, and that a rotator with a jammed azimuth reports a stall fault
+# and gets the CLI back once its address is forgotten.
+#
+# Exits non zero if any check fails.
+# VK5CD
+
+import argparse, os, select, socket, subprocess, sys, threading, time, tty
+
+import multidrop
+
+# Time a byte takes on the wire at 115200 baud (10 bits)
+BYTE_SECS = 10.0 / 115200
+
+
+class Bus(threading.Thread):
+    """Shared bus between the host socket and each rotator pty. Whatever one
+    side sends all others hear, and overlapping rotator transmissions are
+    counted as collisions."""
+
+    def __init__(self, host, rotators):
+        threading.Thread.__init__(self, daemon=True)
+        self.host = host
+        self.rotators = rotators
+        self.busy_until = 0
+        self.busy_fd = None
+        self.collisions = 0
+        self.transmissions = {}
+
+    def run(self):
+        try:
+            self.pass_data()
+        except OSError:
+            pass  # rotator sims killed at the end of the test
+
+    def pass_data(self):
+        fds = [self.host.fileno()] + self.rotators
+        while True:
+            ready, _, _ = select.select(fds, [], [])
+            for fd in ready:
+                data = os.read(fd, 256)
+                now = time.time()
+                if fd != self.host.fileno():
+                    if self.busy_fd not in (None, fd) and now < self.busy_until:
+                        self.collisions += 1
+                    self.busy_fd = fd
+                    self.busy_until = max(now, self.busy_until) + len(data) * BYTE_SECS
+                    self.transmissions[fd] = self.transmissions.get(fd, 0) + 1
+                for other in fds:
+                    if other != fd:
+                        os.write(other, data)
+
+
+class SocketPort:
+    """read/write on a socket, as multidrop.MultidropBus expects of a port"""
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.sock.settimeout(0.01)
+
+    def read(self, n):
+        try:
+            return self.sock.recv(n)
+        except socket.timeout:
+            return b''
+
+    def write(self, data):
+        self.sock.sendall(data)
+
+
+failures = 0
+
+
+def check(condition, description):
+    global failures
+    print('%s: %s' % ('ok  ' if condition else 'FAIL', description))
+    if not condition:
+        failures += 1
+
+
+def start_rotators(sim_path, addresses, jam=False):
+    """Start a simulated rotator for each address, returning (sims, ptys)"""
+    sims, ptys = [], []
+    for address in addresses:
+        sim = subprocess.Popen([sim_path, '--address', str(address), '--heading', str(address * 10),
+                                '--jam', '1' if jam else '0'],
+                               stdout=subprocess.PIPE, universal_newlines=True)
+        sims.append(sim)
+        fd = os.open(sim.stdout.readline().strip(), os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(fd)
+        ptys.append(fd)
+    return sims, ptys
+
+
+def start_bus(ptys):
+    """Join the rotator ptys into a bus, returning (host socket, Bus, MultidropBus)"""
+    host_end, bus_end = socket.socketpair()
+    wire = Bus(bus_end, ptys)
+    wire.start()
+    bus = multidrop.MultidropBus(SocketPort(host_end), timeout=0.5)
+    time.sleep(0.5)
+    return host_end, wire, bus
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Multi-drop bus test with simulated rotators')
+    parser.add_argument('--sim', default='.pio/build/sim/program')
+    parser.add_argument('--count', type=int, default=4)
+    args = parser.parse_args()
+
+    addresses = list(range(1, args.count + 1))
+    sims = []
+    try:
+        sims, ptys = start_rotators(args.sim, addresses)
+        host_end, wire, bus = start_bus(ptys)
+
+        # Addressed cmds only get a response from that rotator
+        for address in addresses:
+            r = bus.status(address)
+            check(r is not None and r.address == address and abs(r.azimuth - address * 10) <= 1,
+                  'status from rotator %d' % address)
+        check(bus.status(args.count + 1) is None, 'no response from missing address')
+
+        # Corrupt frames are ignored
+        frame = bytearray(multidrop.encode_frame(1, multidrop.CMD_STATUS))
+        frame[-1] ^= 0xFF
+        host_end.sendall(bytes(frame))
+        check(not bus._responses(time.time() + 0.3), 'no response to bad crc')
+
+        # Broadcast poll, every rotator responds in its own slot
+        responses = bus.poll(args.count)
+        check(sorted(responses) == addresses, 'poll response from every rotator')
+        check(wire.collisions == 0, 'no collisions on the bus')
+
+        # Stage different targets then move them all together
+        start = responses
+        for address in addresses:
+            r = bus.stage_target(address, 60 + address, 10)
+            check(r is not None and r.status & multidrop.STATUS_STAGED, 'target staged on rotator %d' % address)
+        time.sleep(0.5)
+        responses = bus.poll(args.count)
+        check(all(responses[a].azimuth == start[a].azimuth for a in addresses), 'staged targets not moving yet')
+        bus.go()
+        time.sleep(1.5)
+        responses = bus.poll(args.count)
+        check(all(responses[a].azimuth > start[a].azimuth and not responses[a].status & multidrop.STATUS_STAGED
+                  for a in addresses), 'all rotators moving after broadcast go')
+
+        # Broadcast emergency stop, positions must stop changing
+        bus.emergency_stop()
+        time.sleep(1.0)  # simulated rotators coast to a stop
+        before = bus.poll(args.count)
+        time.sleep(1.0)
+        after = bus.poll(args.count)
+        check(all(before[a].azimuth == after[a].azimuth for a in addresses),
+              'all rotators stopped after broadcast emergency stop')
+
+        # Setting the address, only the rotator addressed takes the new one
+        last = addresses[-1]
+        bus.send(multidrop.BROADCAST, multidrop.CMD_SET_ADDRESS, bytes([last + 5]))
+        time.sleep(0.3)
+        check(sorted(bus.poll(last + 5)) == addresses, 'broadcast set address ignored')
+        r = bus.set_address(last, last + 5)
+        check(r is not None and r.address == last + 5, 'set address responds from the new address')
+        check(sorted(bus.poll(last + 5)) == addresses[:-1] + [last + 5], 'only that rotator has the new address')
+
+        # The CLI isn't answered on the bus, every rotator would talk at once
+        sent = sum(wire.transmissions.values())
+        host_end.sendall(b'g\n')
+        time.sleep(0.3)
+        check(sum(wire.transmissions.values()) == sent, 'CLI ignored on the bus')
+
+        check(wire.collisions == 0, 'no collisions on the bus (%d responses)' % sum(wire.transmissions.values()))
+
+        # Jammed rotator on its own bus, has to stop and report the stall
+        jammed, ptys = start_rotators(args.sim, [1], jam=True)
+        sims += jammed
+        host_end, wire, bus = start_bus(ptys)
+        start = bus.status(1)
+        bus.set_target(1, 90, 0)
+        time.sleep(4.0)
+        r = bus.status(1)
+        check(r is not None and r.status & multidrop.STATUS_FAULT and multidrop.FAULTS[r.fault] == 'az stall'
+              and r.azimuth == start.azimuth, 'jammed rotator reports az stall')
+
+        # It stays stopped, refusing targets, until the fault is cleared
+        bus.set_target(1, 120, 0)
+        time.sleep(1.0)
+        r = bus.status(1)
+        check(r is not None and r.status & multidrop.STATUS_FAULT and r.azimuth == start.azimuth,
+              'faulted rotator refuses a new target')
+        r = bus.clear_fault(1)
+        check(r is not None and not r.status & multidrop.STATUS_FAULT and r.fault == 0, 'fault cleared')
+
+        # Forgetting the address takes it off the bus, back at the default with the CLI
+        r = bus.set_address(1, 0)
+        check(r is not None and r.address == multidrop.DEFAULT_ADDRESS, 'address forgotten')
+        host_end.settimeout(1.0)
+        host_end.sendall(b'g\n')
+        reply = b''
+        try:
+            while b'\n' not in reply:
+                reply += host_end.recv(256)
+        except socket.timeout:
+            pass
+        check(reply.startswith(b'current_orientation:'), 'CLI answered off the bus (%r)' % reply)
+    finally:
+        for sim in sims:
+            sim.kill()
+
+    print('%d failures' % failures)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
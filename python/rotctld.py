@@ -0,0 +1,261 @@
+#!/usr/bin/env python3
+#
+# Hamlib rotctld compatible TCP daemon for the rotator
+#
+# Owns the rotator's serial port and serves the rotctld network protocol to
+# any number of clients at once (Gpredict, Hamlib's rotctl -m 2, logging, a
+# web dashboard, ...), so they can all share one rotator
+#
+#   python3 rotctld.py -p /dev/ttyACM0 [-t 4533]
+#   rotctl -m 2 -r localhost:4533 p
+#
+# Uses the rotator's CLI (see src/serial.cpp), pipelined rather than one
+# request at a time
+#   - the position is polled continuously with 'g', with a couple of polls in
+#     flight, and get_pos is answered from the latest position straight away
+#   - set_pos only records the target, the latest target is sent with 't'
+#     once the previous one has been confirmed, so a fast stream of set_pos
+#     (e.g. Gpredict tracking) is coalesced to whatever is newest
+#
+# Supported commands (short and long forms), each answered as rotctld does
+#   p  get_pos, P  set_pos <az> <el>, S  stop, K  park, _  get_info,
+#   dump_state, q  quit (close the connection)
+#
+# Tested against the host simulated rotator with rotctld_test.py
+# VK5CD
+
+import argparse, os, select, socket, sys, termios, time, tty
+
+# Must match src/config.h, azimuth is reported -180..180
+MIN_AZ = -180.0
+MAX_AZ = 180.0
+MIN_EL = -20.0
+MAX_EL = 85.0
+
+# rotctld protocol version and rotator model, for dump_state. Hamlib's
+# netrotctl (rotctl -m 2) reads the model line after the version and skips
+# it, so it has to be there. There's no Hamlib backend for this rotator, so
+# it claims to be the dummy rotator (ROT_MODEL_DUMMY).
+PROTOCOL_VERSION = 1
+ROTATOR_MODEL = 1
+
+# Hamlib error codes, sent back as RPRT -<code>
+RIG_OK = 0
+RIG_EINVAL = 1
+RIG_ENIMPL = 4
+RIG_ETIMEOUT = 5
+
+POLL_SECS = 0.1           # how often to ask for the position
+MAX_POLLS_IN_FLIGHT = 2   # position requests sent but not yet answered
+REPLY_TIMEOUT_SECS = 1.0  # give up waiting for an answer after this
+STALE_SECS = 2.0          # get_pos fails if the position is older than this
+
+
+def open_serial(path, speed=115200):
+    """Open a serial port (or pty) raw, returning the file descriptor"""
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+    tty.setraw(fd)
+    attrs = termios.tcgetattr(fd)
+    baud = getattr(termios, 'B%d' % speed)
+    attrs[4] = attrs[5] = baud
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+class Rotator:
+    """The serial link to the rotator, with the cached position and
+    coalesced target. Call update() whenever the link is readable, and at
+    least every POLL_SECS"""
+
+    def __init__(self, fd):
+        self.fd = fd
+        self.buf = b''
+        self.azimuth = None
+        self.elevation = None
+        self.position_time = 0
+        self.polls_in_flight = 0
+        self.last_poll_time = 0
+        self.target = None          # latest target asked for, not yet sent
+        self.target_sent_time = None
+        # Counters, to see how much the link is being spared
+        self.polls_sent = 0
+        self.targets_sent = 0
+        self.targets_received = 0
+
+    def send(self, text):
+        os.write(self.fd, text.encode('ascii'))
+
+    def set_target(self, azimuth, elevation):
+        self.target = (int(round(azimuth)), int(round(elevation)))
+        self.targets_received += 1
+
+    def stop(self):
+        self.target = None
+        self.send('s\n')
+
+    def park(self):
+        self.target = None
+        self.send('h\n')
+
+    def position(self):
+        """(azimuth, elevation), or None if not heard from the rotator lately"""
+        if self.azimuth is None or time.time() - self.position_time > STALE_SECS:
+            return None
+        return self.azimuth, self.elevation
+
+    def read(self):
+        try:
+            data = os.read(self.fd, 256)
+        except BlockingIOError:
+            return
+        self.buf += data
+        while b'\n' in self.buf:
+            line, self.buf = self.buf.split(b'\n', 1)
+            self.handle_line(line.decode('ascii', 'replace').strip())
+
+    def handle_line(self, line):
+        # Anything else (debug, trace records) is ignored
+        words = line.split()
+        if len(words) == 3 and words[0] == 'current_orientation:':
+            self.azimuth, self.elevation = int(words[1]), int(words[2])
+            self.position_time = time.time()
+            self.polls_in_flight = max(0, self.polls_in_flight - 1)
+        elif words and words[0] == 'set_target:':   # taken, or refused after a fault
+            self.target_sent_time = None
+
+    def update(self):
+        now = time.time()
+        # Lost answers (e.g. rotator reset) don't hold up the link for ever
+        if self.polls_in_flight and now - self.last_poll_time > REPLY_TIMEOUT_SECS:
+            self.polls_in_flight = 0
+        if self.target_sent_time is not None and now - self.target_sent_time > REPLY_TIMEOUT_SECS:
+            self.target_sent_time = None
+
+        # Only the newest target is sent, once the last one has been taken
+        if self.target is not None and self.target_sent_time is None:
+            self.send('t%d,%d\n' % self.target)
+            self.target = None
+            self.target_sent_time = now
+            self.targets_sent += 1
+
+        if now - self.last_poll_time >= POLL_SECS and self.polls_in_flight < MAX_POLLS_IN_FLIGHT:
+            self.send('g\n')
+            self.polls_in_flight += 1
+            self.last_poll_time = now
+            self.polls_sent += 1
+
+
+class Client:
+    """One rotctld connection"""
+
+    def __init__(self, sock, rotator):
+        self.sock = sock
+        self.rotator = rotator
+        self.buf = b''
+
+    def read(self):
+        """Handle whatever commands have arrived, returns False once closed"""
+        try:
+            data = self.sock.recv(1024)
+        except ConnectionError:
+            return False
+        if not data:
+            return False
+        self.buf += data
+        while b'\n' in self.buf:
+            line, self.buf = self.buf.split(b'\n', 1)
+            reply = self.command(line.decode('ascii', 'replace').strip())
+            if reply is None:
+                return False
+            try:
+                self.sock.sendall(reply.encode('ascii'))
+            except ConnectionError:
+                return False
+        return True
+
+    def command(self, line):
+        """Reply to one command line, None to close the connection"""
+        words = line.replace(',', ' ').split()
+        if not words:
+            return ''
+        cmd, args = words[0].lstrip('\\'), words[1:]
+        if cmd in ('p', 'get_pos'):
+            position = self.rotator.position()
+            if position is None:
+                return 'RPRT -%d\n' % RIG_ETIMEOUT
+            return '%f\n%f\n' % position
+        if cmd in ('P', 'set_pos'):
+            try:
+                azimuth, elevation = float(args[0]), float(args[1])
+            except (IndexError, ValueError):
+                return 'RPRT -%d\n' % RIG_EINVAL
+            # Clients often use 0..360
+            if azimuth > MAX_AZ:
+                azimuth -= 360
+            if not (MIN_AZ <= azimuth <= MAX_AZ and MIN_EL <= elevation <= MAX_EL):
+                return 'RPRT -%d\n' % RIG_EINVAL
+            self.rotator.set_target(azimuth, elevation)
+            return 'RPRT 0\n'
+        if cmd in ('S', 'stop'):
+            self.rotator.stop()
+            return 'RPRT 0\n'
+        if cmd in ('K', 'park'):
+            self.rotator.park()
+            return 'RPRT 0\n'
+        if cmd in ('_', 'get_info'):
+            return 'rotator_areg\n'
+        if cmd == 'dump_state':
+            return '%d\n%d\n%f\n%f\n%f\n%f\n' % (PROTOCOL_VERSION, ROTATOR_MODEL, MIN_AZ, MAX_AZ, MIN_EL, MAX_EL)
+        if cmd in ('q', 'Q'):
+            return None
+        return 'RPRT -%d\n' % RIG_ENIMPL
+
+
+class Daemon:
+    """Serves rotctld clients on a TCP port from one Rotator"""
+
+    def __init__(self, rotator, host='localhost', port=4533):
+        self.rotator = rotator
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind((host, port))
+        self.listener.listen(8)
+        self.port = self.listener.getsockname()[1]
+        self.clients = {}
+
+    def run(self, until=None):
+        """Serve clients until the time given (for ever if None)"""
+        while until is None or time.time() < until:
+            fds = [self.listener, self.rotator.fd] + list(self.clients)
+            ready, _, _ = select.select(fds, [], [], POLL_SECS / 2)
+            for fd in ready:
+                if fd is self.listener:
+                    sock, _ = self.listener.accept()
+                    self.clients[sock] = Client(sock, self.rotator)
+                elif fd == self.rotator.fd:
+                    self.rotator.read()
+                elif not self.clients[fd].read():
+                    fd.close()
+                    del self.clients[fd]
+            self.rotator.update()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='rotctld compatible TCP daemon for the rotator')
+    parser.add_argument('-p', '--port', default='/dev/ttyACM0', help='rotator serial port')
+    parser.add_argument('-s', '--speed', type=int, default=115200)
+    parser.add_argument('-T', '--listen-addr', default='localhost')
+    parser.add_argument('-t', '--tcp-port', type=int, default=4533)
+    args = parser.parse_args()
+
+    daemon = Daemon(Rotator(open_serial(args.port, args.speed)), args.listen_addr, args.tcp_port)
+    print('rotctld on %s:%d for %s' % (args.listen_addr, daemon.port, args.port))
+    try:
+        daemon.run()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#
+# rotctld daemon test against a simulated rotator
+#
+# Starts a host simulated rotator (host/sim, on a pty, running the real
+# firmware CLI code) and the rotctld daemon (rotctld.py) on it, then checks
+# several clients at once can read the position and set targets, that
+# get_pos is served from the cached position, and that a fast stream of
+# set_pos is coalesced to the latest target
+#
+#   pio run -e sim
+#   python3 rotctld_test.py [--sim .pio/build/sim/program]
+#
+# Exits non zero if any check fails.
+# VK5CD
+
+import argparse, socket, subprocess, sys, threading, time
+
+import rotctld
+
+# The rotator stops once within 5 x the tolerance (0.1 degrees) of the target,
+# see rotator_update() and the default tuning in src/config.h
+AZ_TOLERANCE = 14 * 5 / 10.0
+EL_TOLERANCE = 6 * 5 / 10.0
+
+failures = 0
+
+
+def check(condition, description):
+    global failures
+    print('%s: %s' % ('ok  ' if condition else 'FAIL', description))
+    if not condition:
+        failures += 1
+
+
+class Client:
+    """A rotctld client, as Gpredict or rotctl -m 2 would talk to it"""
+
+    def __init__(self, port):
+        self.sock = socket.create_connection(('localhost', port))
+        self.file = self.sock.makefile('r')
+
+    def command(self, line, lines=1):
+        self.sock.sendall((line + '\n').encode('ascii'))
+        return [self.file.readline().strip() for _ in range(lines)]
+
+    def get_pos(self):
+        reply = self.command('p', 2)
+        if reply[0].startswith('RPRT'):
+            return None
+        return float(reply[0]), float(reply[1])
+
+    def close(self):
+        self.sock.close()
+
+
+def wait_for_position(client, azimuth, elevation, secs):
+    """True once the rotator has stopped near the position, polling get_pos"""
+    until = time.time() + secs
+    previous = None
+    while time.time() < until:
+        position = client.get_pos()
+        if position and position == previous and abs(position[0] - azimuth) <= AZ_TOLERANCE \
+                and abs(position[1] - elevation) <= EL_TOLERANCE:
+            return True
+        previous = position
+        time.sleep(0.5)
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description='rotctld daemon test with a simulated rotator')
+    parser.add_argument('--sim', default='.pio/build/sim/program')
+    args = parser.parse_args()
+
+    sim = subprocess.Popen([args.sim, '--heading', '30'], stdout=subprocess.PIPE, universal_newlines=True)
+    try:
+        rotator = rotctld.Rotator(rotctld.open_serial(sim.stdout.readline().strip()))
+        daemon = rotctld.Daemon(rotator, port=0)
+        threading.Thread(target=daemon.run, daemon=True).start()
+        time.sleep(0.5)
+
+        clients = [Client(daemon.port) for _ in range(3)]
+        position = clients[0].get_pos()
+        check(position is not None and abs(position[0] - 30) <= 1 and abs(position[1]) <= 1,
+              'get_pos reads the starting position (%s)' % (position,))
+        # As netrotctl reads it: version, model, then the limits, nothing more
+        state = clients[1].command('\\dump_state', 6)
+        check(state == ['1', '1', '-180.000000', '180.000000', '-20.000000', '85.000000'],
+              'dump_state (%s)' % (state,))
+        check(clients[1].command('_') == ['rotator_areg'], 'nothing after dump_state')
+        check(clients[2].command('_') == ['rotator_areg'], 'get_info')
+        check(clients[2].command('\\bogus') == ['RPRT -%d' % rotctld.RIG_ENIMPL], 'unknown cmd rejected')
+        check(clients[2].command('P 10') == ['RPRT -%d' % rotctld.RIG_EINVAL], 'set_pos with no elevation rejected')
+        check(clients[2].command('P 10 89') == ['RPRT -%d' % rotctld.RIG_EINVAL], 'set_pos above elevation limit rejected')
+
+        # Every client polling as fast as it can only gets the cached position,
+        # the serial link is still polled at its own rate
+        polls = rotator.polls_sent
+        start = time.time()
+        queries = 0
+        while time.time() - start < 1.0:
+            for client in clients:
+                queries += client.get_pos() is not None
+        polls = rotator.polls_sent - polls
+        check(queries > 100 and polls <= 2 / rotctld.POLL_SECS,
+              '%d get_pos from 3 clients in 1 sec took %d serial polls' % (queries, polls))
+
+        # A burst of set_pos, as from tracking, only moves to the latest
+        sent = rotator.targets_sent
+        for i in range(100):
+            check_reply = clients[i % 2].command('P %d 10' % (300 + i % 40))
+            if check_reply != ['RPRT 0']:
+                break
+        check(check_reply == ['RPRT 0'], 'set_pos burst accepted')
+        clients[2].command('\\set_pos 50.0 10.0')
+        time.sleep(0.5)
+        sent = rotator.targets_sent - sent
+        check(sent < 20, '101 set_pos coalesced to %d serial targets' % sent)
+        check(wait_for_position(clients[0], 50, 10, 10), 'rotator moved to the latest target')
+
+        # Stop while moving, position stops changing
+        clients[1].command('P 90 10')
+        time.sleep(3.0)
+        check(clients[1].command('S') == ['RPRT 0'], 'stop accepted')
+        time.sleep(1.5)  # simulated rotator coasts to a stop
+        before = clients[0].get_pos()
+        time.sleep(1.0)
+        after = clients[0].get_pos()
+        check(before == after and 50 < after[0] < 90, 'rotator stopped (%s)' % (after,))
+
+        # Closing one client leaves the others working
+        check(clients[2].command('q') == [''], 'quit closes the connection')
+        check(clients[0].get_pos() == after, 'other clients still served')
+        for client in clients:
+            client.close()
+    finally:
+        sim.kill()
+
+    print('%d failures' % failures)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+#
+# Capture binary trace records from the rotator
+#
+# Turns on trace recording with the CLI 'r<n>' cmd, then saves every valid
+# trace record received to a file until Ctrl-C (or --seconds), and turns
+# recording off again. The file can be replayed on the host with
+#   pio run -e replay
+#   .pio/build/replay/program <trace file>
+# or decoded to CSV for plotting with --decode. Any debug log records (see
+# debuglog.py) received while capturing are saved too.
+#
+# Examples
+#   python3 trace_capture.py -p /dev/ttyACM0 -o run1.trace
+#   python3 trace_capture.py --decode run1.trace > run1.csv
+# VK5CD
+
+import argparse, struct, time
+
+# Must match src/trace.h
+SYNC = b'\xa5\x5a'
+TYPE_UPDATE = ord('U')
+TYPE_COMMAND = ord('C')
+TYPE_TUNING = ord('T')
+TYPE_FAULT = ord('F')
+TYPE_STATE = ord('S')
+TYPE_LOG = ord('L')
+UPDATE_FORMAT = '<HI3h3h6h'
+COMMAND_FORMAT = '<Hc2h3h3h'
+UPDATE_FIELDS = ['tick', 'msecs', 'accel_x', 'accel_y', 'accel_z',
+                 'mag_x', 'mag_y', 'mag_z', 'heading', 'pitch',
+                 'target_heading', 'target_pitch', 'az_pwm', 'el_pwm']
+
+
+def fletcher16(data):
+    a = b = 0
+    for x in data:
+        a = (a + x) % 255
+        b = (b + a) % 255
+    return a, b
+
+
+def extract_records(buf):
+    """Return (records, remaining buffer), each record is (type, payload, raw frame bytes)"""
+    records = []
+    pos = 0
+    while True:
+        pos = buf.find(SYNC, pos)
+        if pos < 0 or pos + 6 > len(buf):
+            break
+        length = buf[pos + 3]
+        end = pos + 6 + length
+        if end > len(buf):
+            break
+        if fletcher16(buf[pos + 2:pos + 4 + length]) == (buf[end - 2], buf[end - 1]):
+            records.append((buf[pos + 2], bytes(buf[pos + 4:pos + 4 + length]), bytes(buf[pos:end])))
+            pos = end
+        else:
+            pos += 1  # false sync, e.g. in CLI text
+    if pos < 0:
+        # keep a trailing partial sync byte
+        return records, buf[-1:] if buf[-1:] == SYNC[:1] else bytearray()
+    return records, buf[pos:]
+
+
+def capture(args):
+    import serial
+    ser = serial.Serial(port=args.port, baudrate=args.speed, timeout=0.1)
+    time.sleep(2)  # Uno resets when port opened
+    ser.reset_input_buffer()
+    ser.write(('r%d\n' % args.decimation).encode())
+
+    counts = {TYPE_UPDATE: 0, TYPE_COMMAND: 0, TYPE_STATE: 0}
+    gaps = 0
+    last_tick = None
+    buf = bytearray()
+    start = time.time()
+    with open(args.output, 'wb') as out:
+        try:
+            while args.seconds == 0 or time.time() - start < args.seconds:
+                buf += ser.read(4096)
+                records, buf = extract_records(buf)
+                for rtype, payload, frame in records:
+                    out.write(frame)
+                    counts[rtype] = counts.get(rtype, 0) + 1
+                    if rtype == TYPE_UPDATE:
+                        tick = struct.unpack_from('<H', payload)[0]
+                        if last_tick is not None and tick != (last_tick + args.decimation) & 0xffff:
+                            gaps += 1
+                        last_tick = tick
+        except KeyboardInterrupt:
+            pass
+    ser.write(b'r0\n')
+    print('updates: %d commands: %d snapshots: %d gaps: %d' %
+          (counts[TYPE_UPDATE], counts[TYPE_COMMAND], counts[TYPE_STATE], gaps))
+
+
+def decode(args):
+    with open(args.decode, 'rb') as f:
+        records, _ = extract_records(bytearray(f.read()))
+    print(','.join(['type'] + UPDATE_FIELDS + ['command']))
+    blank = [''] * (len(UPDATE_FIELDS) - 1)
+    for rtype, payload, _ in records:
+        if rtype == TYPE_UPDATE and len(payload) == struct.calcsize(UPDATE_FORMAT):
+            print(','.join(['U'] + [str(v) for v in struct.unpack(UPDATE_FORMAT, payload)] + ['']))
+        elif rtype == TYPE_COMMAND and len(payload) == struct.calcsize(COMMAND_FORMAT):
+            tick, cmd, az, el = struct.unpack(COMMAND_FORMAT, payload)[:4]
+            row = ['C', str(tick)] + blank
+            row[UPDATE_FIELDS.index('target_heading') + 1] = str(az * 10)
+            row[UPDATE_FIELDS.index('target_pitch') + 1] = str(el * 10)
+            print(','.join(row + [cmd.decode()]))
+        elif rtype in (TYPE_TUNING, TYPE_FAULT, TYPE_STATE):
+            print(','.join([chr(rtype), str(struct.unpack_from('<H', payload)[0])] + blank + ['']))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Capture/decode rotator_areg binary traces')
+    parser.add_argument('-p', '--port', default='/dev/ttyACM0')
+    parser.add_argument('-s', '--speed', type=int, default=115200)
+    parser.add_argument('-d', '--decimation', type=int, default=1,
+                        help='record every n rotator updates, 1 needed for exact replay')
+    parser.add_argument('-o', '--output', default='rotator.trace')
+    parser.add_argument('-t', '--seconds', type=float, default=0, help='0 = until Ctrl-C')
+    parser.add_argument('--decode', metavar='TRACE', help='print a captured trace as CSV')
+    args = parser.parse_args()
+
+    if args.decode:
+        decode(args)
+    else:
+        capture(args)
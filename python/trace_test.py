@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+#
+# Trace recording and replay test against a simulated rotator
+#
+# Starts a host simulated rotator (host/sim, on a pty, running the real
+# firmware with a serial tx buffer as small and slow as the Uno's), records
+# a trace with 'r1' while it moves, stops and goes idle, and checks the trace
+# has update records and whole snapshots in it, and that the host replay
+# (host/replay) matches every update, moving or not
+#
+#   pio run -e sim
+#   pio run -e replay
+#   python3 trace_test.py [--sim .pio/build/sim/program] [--replay .pio/build/replay/program]
+#
+# Exits non zero if any check fails.
+# VK5CD
+
+import argparse, os, select, subprocess, sys, tempfile, time
+
+import rotctld
+import struct
+
+from trace_capture import extract_records, TYPE_UPDATE, TYPE_TUNING, TYPE_FAULT, TYPE_STATE
+
+# Update record az and el pwm, the last two int16 (see src/trace.h)
+PWM_FORMAT = '<hh'
+
+failures = 0
+
+
+def check(condition, description):
+    global failures
+    print('%s: %s' % ('ok  ' if condition else 'FAIL', description))
+    if not condition:
+        failures += 1
+
+
+def record(fd, secs, buf, records):
+    """Read from the rotator for secs, adding any trace records"""
+    until = time.time() + secs
+    while time.time() < until:
+        ready, _, _ = select.select([fd], [], [], 0.1)
+        if ready:
+            buf += os.read(fd, 4096)
+            new, buf[:] = extract_records(buf)
+            records.extend(new)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='trace recording and replay test with a simulated rotator')
+    parser.add_argument('--sim', default='.pio/build/sim/program')
+    parser.add_argument('--replay', default='.pio/build/replay/program')
+    args = parser.parse_args()
+
+    sim = subprocess.Popen([args.sim, '--heading', '30'], stdout=subprocess.PIPE, universal_newlines=True)
+    records = []
+    try:
+        fd = rotctld.open_serial(sim.stdout.readline().strip())
+        buf = bytearray()
+        record(fd, 1, buf, [])
+        os.write(fd, b'r1\n')
+        record(fd, 1, buf, records)
+        os.write(fd, b't60,20\n')
+        record(fd, 15, buf, records)   # moves, then idle
+        os.write(fd, b't40,10\n')
+        record(fd, 12, buf, records)   # moves, then goes idle
+        os.write(fd, b'r0\n')
+        record(fd, 0.5, buf, records)
+    finally:
+        sim.kill()
+
+    counts = {}
+    moving = 0
+    for rtype, payload, _ in records:
+        counts[rtype] = counts.get(rtype, 0) + 1
+        if rtype == TYPE_UPDATE and struct.unpack(PWM_FORMAT, payload[-4:]) != (0, 0):
+            moving += 1
+    check(counts.get(TYPE_UPDATE, 0) > 0, 'update records sent (%d, %d moving)' % (counts.get(TYPE_UPDATE, 0), moving))
+    check(moving >= 100, 'update records sent while moving')
+    check(all(counts.get(t, 0) > 0 for t in (TYPE_TUNING, TYPE_FAULT, TYPE_STATE)),
+          'snapshots sent (%d tuning, %d fault, %d state)' %
+          (counts.get(TYPE_TUNING, 0), counts.get(TYPE_FAULT, 0), counts.get(TYPE_STATE, 0)))
+    check(counts.get(TYPE_STATE, 0) <= 2, 'no snapshot after the first (%d)' % counts.get(TYPE_STATE, 0))
+
+    with tempfile.NamedTemporaryFile(suffix='.trace') as trace:
+        for _, _, frame in records:
+            trace.write(frame)
+        trace.flush()
+        replay = subprocess.run([args.replay, trace.name], stdout=subprocess.PIPE, universal_newlines=True)
+    summary = replay.stdout.strip().splitlines()[-1] if replay.stdout.strip() else ''
+    print('      replay %s' % summary)
+    check(replay.returncode == 0, 'replay matches every update it replays')
+    replayed = int(summary.split('updates:')[1].split()[0]) if 'updates:' in summary else 0
+    replayed_moving = int(summary.split('moving:')[1].split(')')[0]) if 'moving:' in summary else 0
+    check(replayed >= counts.get(TYPE_UPDATE, 0) - 1, 'replay covers every update (%d of %d)'
+          % (replayed, counts.get(TYPE_UPDATE, 0)))
+    check(replayed_moving == moving and moving > 0, 'replay matches every update while moving (%d of %d)'
+          % (replayed_moving, moving))
+
+    print('%d failures' % failures)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -4,8 +4,10 @@
 
 #include "ahrs.h"
 #include "config.h"
+#include "magcal.h"
+#include "debuglog.h"
 
-// Observations about Adafruit Simple AHRS library and returned values
+// Observations about Adafruit Simple AHRS calculation and returned values
 //
 // the get_orientation function (see below) adjusts these returned
 // values to something more sensible
@@ -23,50 +25,80 @@
 //  - +/- 180 degrees is south (wraps around)
 
 
-// Create sensor instances.
-Adafruit_LSM303_Accel_Unified accel(30301);
-Adafruit_LSM303_Mag_Unified   mag(30302);
+// Last raw sample used to calculate orientation (for tracing)
+ahrs_raw_values last_raw ;
 
-// Create simple AHRS algorithm using the above sensors.
-Adafruit_Simple_AHRS          ahrs(&accel, &mag);
+// Calculate orientation (in degrees) from a raw sample
+// This is the same calculation the Adafruit Simple AHRS library uses, but
+// done here from our fixed point raw values so results can be reproduced
+void ahrs_raw_to_orientation(const ahrs_raw_values * raw, float * roll, float * pitch, float * heading)
+{
+  float const PI_F = 3.14159265F;
+  float accel_x = raw->accel[0] / 100.0F ;
+  float accel_y = raw->accel[1] / 100.0F ;
+  float accel_z = raw->accel[2] / 100.0F ;
+  float mag_x = raw->mag[0] / 10.0F ;
+  float mag_y = raw->mag[1] / 10.0F ;
+  float mag_z = raw->mag[2] / 10.0F ;
 
+  // roll: Rotation around the X-axis. -180 <= roll <= 180
+  *roll = atan2(accel_y, accel_z);
 
-// Inital setup of the 9DOF board
-void ahrs_setup()
-{
-  // Initialize the sensors.
-  accel.begin();
-  mag.begin();
+  // pitch: Rotation around the Y-axis. -180 <= pitch <= 180
+  float pitch_divisor = accel_y * sin(*roll) + accel_z * cos(*roll);
+  if ( pitch_divisor == 0 )
+    *pitch = accel_x > 0 ? (PI_F / 2) : (-PI_F / 2);
+  else
+    *pitch = atan(-accel_x / pitch_divisor);
+
+  // heading: Rotation around the Z-axis. -180 <= heading <= 180
+  *heading = atan2(mag_z * sin(*roll) - mag_y * cos(*roll),
+                   mag_x * cos(*pitch) +
+                   mag_y * sin(*pitch) * sin(*roll) +
+                   mag_z * sin(*pitch) * cos(*roll));
+
+  // Convert to degrees
+  *roll = *roll * 180 / PI_F;
+  *pitch = *pitch * 180 / PI_F;
+  *heading = *heading * 180 / PI_F;
 }
 
-// Return sensible values for orientation from simple AHRS library
+// Return sensible values for orientation from the AHRS calculation
 // This takes into consideration the way the board is mounted on the rotator
 // and will ultimately require a configuration setting to change in future
 //
 // Occasionally get random errors from heading (magnetometer) so following
 // is to ignore values if too far different from last values
+// The motor currents also disturb it as they start, stop or reverse, so the
+// heading is held until they settle (the steady offset is taken off the raw
+// sample, see magcal.h)
 int heading_errors_count = 0 ;
 //
-bool get_orientation(sensors_vec_t * orientation, bool initial_setting)
+bool get_orientation(ahrs_orientation * orientation, bool initial_setting)
 {
-  int prev_heading = orientation->heading ;
+  float roll, pitch, heading ;
 
-  bool ret_val = ahrs.getOrientation(orientation);
+  ahrs_read_raw(&last_raw);
+  ahrs_raw_to_orientation(&last_raw, &roll, &pitch, &heading);
 
-  // Adjust Simple AHRS values to make sense
-  int adj_heading = - orientation->heading + 180 ;
-  if ( adj_heading > 180 ) adj_heading -= 360 ;
+  // Adjust AHRS values to make sense
+  int adj_heading = round( ( - heading + 180 ) * 10 ) ;
+  if ( adj_heading > 1800 ) adj_heading -= 3600 ;
 
-  // Check (using wrap around, hence %360) that haven't exceeded maximum degrees allowed
-  if ( abs( ((adj_heading+360)%360) - ((prev_heading+360)%360) ) > max_heading_degrees_change_allowed )
+  // Keep the last heading while a motor current settles
+  if ( magcal_blanking() && ! initial_setting )
+  {
+    orientation->pitch = round( pitch * 10 ) ;
+    return true ;
+  }
+
+  // Check (using wrap around, hence %3600) that haven't exceeded maximum degrees allowed
+  if ( abs( ((adj_heading+3600)%3600) - ((orientation->heading+3600)%3600) ) > max_heading_degrees_change_allowed * 10 )
   {
     // Too great a difference, so ignore it
     heading_errors_count ++ ;
 
-    #ifdef DEBUG_SERIAL
-      Serial.print(F("HEADING ERROR: "));
-      Serial.println(heading_errors_count);
-    #endif
+    debuglog_event(debuglog_heading_error, heading_errors_count, adj_heading, orientation->heading);
 
     if ( heading_errors_count > max_heading_errors_allowed )
     {
@@ -84,7 +116,25 @@ bool get_orientation(sensors_vec_t * orientation, bool initial_setting)
     orientation->heading = adj_heading ; // 0 degrees north, then positive clockwise
   }
 
+  orientation->pitch = round( pitch * 10 ) ;
   // orientation->pitch = - orientation->pitch ; // 0 degrees level/horizon, then positive increases pitch
 
-  return ret_val ;
+  return true ;
+}
+
+// Return the raw sample used by the last get_orientation call
+void ahrs_last_raw_values(ahrs_raw_values * raw)
+{
+  *raw = last_raw ;
+}
+
+// Access the heading error filter state (for trace/replay snapshots)
+int ahrs_heading_errors()
+{
+  return heading_errors_count ;
+}
+//
+void ahrs_set_heading_errors(int count)
+{
+  heading_errors_count = count ;
 }
@@ -2,11 +2,33 @@
 // rototor_areg
 // VK5CD
 
-#include <Wire.h>
-#include <Adafruit_Sensor.h>
-#include <Adafruit_LSM303_U.h>
-#include <Adafruit_Simple_AHRS.h>
+#include <Arduino.h>
+
+// Raw sample from the accelerometer and magnetometer
+// Held as fixed point so that exactly the same values used to calculate
+// orientation can be traced and later replayed on a host
+//  - accel in 0.01 m/s^2
+//  - mag in 0.1 uT
+struct ahrs_raw_values
+{
+  int16_t accel[3]; // x, y, z
+  int16_t mag[3];   // x, y, z
+};
+
+// Orientation as used by the rotator, in 0.1 degrees
+//  - heading 0 is north, then positive clockwise, -1800..1800
+//  - pitch 0 is level/horizon
+struct ahrs_orientation
+{
+  int16_t heading;
+  int16_t pitch;
+};
 
 // Our Functions
 void ahrs_setup();
-bool get_orientation(sensors_vec_t * orientation, bool initial_setting = false);
+void ahrs_read_raw(ahrs_raw_values * raw);
+void ahrs_set_low_power(bool low_power);
+bool get_orientation(ahrs_orientation * orientation, bool initial_setting = false);
+void ahrs_last_raw_values(ahrs_raw_values * raw);
+int ahrs_heading_errors();
+void ahrs_set_heading_errors(int count);
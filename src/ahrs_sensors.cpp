@@ -0,0 +1,113 @@
+// Functions related to reading the raw 9DOF sensors used by the AHRS
+// rototor_areg
+// VK5CD
+//
+// Only the hardware access lives here, so that the host builds (see host/)
+// can substitute recorded samples and run the rest of the AHRS and rotator
+// code unmodified
+//
+// The LSM303 registers are accessed directly rather than through the Adafruit
+// unified sensor objects, which saves their RAM (floats and vtables) and the
+// library code. Settings and scaling are the same as the Adafruit library.
+
+#include <Wire.h>
+
+#include "ahrs.h"
+#include "magcal.h"
+
+// LSM303 I2C addresses and registers
+const byte lsm303_accel_address = 0x19 ;
+const byte lsm303_accel_ctrl_reg1 = 0x20 ;
+const byte lsm303_accel_out_x_l = 0x28 ;
+const byte lsm303_mag_address = 0x1E ;
+const byte lsm303_mag_cra_reg = 0x00 ;
+const byte lsm303_mag_crb_reg = 0x01 ;
+const byte lsm303_mag_mr_reg = 0x02 ;
+const byte lsm303_mag_out_x_h = 0x03 ;
+
+// Register settings
+const byte lsm303_accel_100hz_xyz = 0x57 ; // 100Hz, normal power, all axes
+const byte lsm303_accel_10hz_low_power_xyz = 0x2F ; // 10Hz, low power (8 bit), all axes
+const byte lsm303_mag_15hz = 0x10 ;
+const byte lsm303_mag_gain_1_3 = 0x20 ;    // +/- 1.3 gauss
+const byte lsm303_mag_continuous = 0x00 ;
+const byte lsm303_mag_single = 0x01 ;      // one conversion then sleep
+
+// Low power while the rotator is idle, see ahrs_set_low_power()
+bool lsm303_low_power = false ;
+
+// Write a single sensor register
+void lsm303_write(byte address, byte reg, byte value)
+{
+  Wire.beginTransmission(address);
+  Wire.write(reg);
+  Wire.write(value);
+  Wire.endTransmission();
+}
+
+// Read 6 bytes of sensor output registers
+void lsm303_read6(byte address, byte reg, byte * buf)
+{
+  Wire.beginTransmission(address);
+  Wire.write(reg);
+  Wire.endTransmission();
+  Wire.requestFrom(address, (byte)6);
+  for ( byte i = 0 ; i < 6 ; i++ )
+    buf[i] = Wire.read();
+}
+
+// Inital setup of the 9DOF board
+void ahrs_setup()
+{
+  Wire.begin();
+  lsm303_write(lsm303_accel_address, lsm303_accel_ctrl_reg1, lsm303_accel_100hz_xyz);
+  lsm303_write(lsm303_mag_address, lsm303_mag_cra_reg, lsm303_mag_15hz);
+  lsm303_write(lsm303_mag_address, lsm303_mag_mr_reg, lsm303_mag_continuous);
+  lsm303_write(lsm303_mag_address, lsm303_mag_crb_reg, lsm303_mag_gain_1_3);
+}
+
+// Read both sensors and convert to our fixed point raw values
+void ahrs_read_raw(ahrs_raw_values * raw)
+{
+  byte buf[6];
+
+  // Accel is 12 bit left justified, low byte first, 1mg per bit
+  // 0.01 m/s^2 = mg * 9.80665 / 10
+  lsm303_read6(lsm303_accel_address, lsm303_accel_out_x_l | 0x80, buf); // 0x80 = auto increment
+  for ( byte i = 0 ; i < 3 ; i++ )
+  {
+    long mg = int16_t(buf[i*2] | (buf[i*2+1] << 8)) >> 4 ;
+    raw->accel[i] = ( mg * 98066L ) / 100000L ;
+  }
+
+  // Mag is high byte first, and in X, Z, Y order
+  // 0.1 uT = count / gauss per count * 1000, 1100 per gauss for X/Y, 980 for Z
+  lsm303_read6(lsm303_mag_address, lsm303_mag_out_x_h, buf);
+  long mag_x = int16_t((buf[0] << 8) | buf[1]) ;
+  long mag_z = int16_t((buf[2] << 8) | buf[3]) ;
+  long mag_y = int16_t((buf[4] << 8) | buf[5]) ;
+  raw->mag[0] = ( mag_x * 1000 ) / 1100 ;
+  raw->mag[1] = ( mag_y * 1000 ) / 1100 ;
+  raw->mag[2] = ( mag_z * 1000 ) / 980 ;
+
+  // Less the motor currents, so the recorded (traced) sample is the one used
+  magcal_compensate(raw->mag);
+
+  // Start the conversion for the next read, so the mag sleeps in between
+  if ( lsm303_low_power )
+    lsm303_write(lsm303_mag_address, lsm303_mag_mr_reg, lsm303_mag_single);
+}
+
+// Put the sensors in low power while the rotator is idle and only reading a
+// few times a second, or back to full rate
+// In low power the accel has less resolution (8 bit), and the mag only does a
+// single conversion after each read, so the next read is that old. Both are
+// fine while parked.
+void ahrs_set_low_power(bool low_power)
+{
+  lsm303_low_power = low_power ;
+  lsm303_write(lsm303_accel_address, lsm303_accel_ctrl_reg1,
+               low_power ? lsm303_accel_10hz_low_power_xyz : lsm303_accel_100hz_xyz);
+  lsm303_write(lsm303_mag_address, lsm303_mag_mr_reg,
+               low_power ? lsm303_mag_single : lsm303_mag_continuous);
+}
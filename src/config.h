@@ -2,9 +2,6 @@
 // rototor_areg
 // VK5CD
 
-// Define if you want debug serial messages printed
-#undef DEBUG_SERIAL
-
 // Initial values for configuration parameters
 // Should eventually end up in flash/eeprom so can be configured later
 const int az_tolerance_degrees = 14 ;
@@ -17,6 +14,16 @@ const int el_min_degrees = -20 ; // 20 degrees down below horizon
 const int el_max_degrees = 85 ; // 90 is pointing straight up
 const int az_motor_max_pwm = 255 ; // 255 is maximum PWM can use with analogWrite
 const int el_motor_max_pwm = 255 ;
+const int az_motor_min_pwm = 0 ; // deadband, pwm below this doesn't move the axis
+const int el_motor_min_pwm = 0 ;
+// Backlash compensation (see rotator.cpp), the play in each axis gears and which way to
+// always finish a move (1 = clockwise/pitch up, -1 = anti-clockwise/pitch down, 0 = either).
+// After a reversal the pwm is held under halfway between min and max until the axis moves,
+// for up to fault_window_msecs
+const int az_backlash_degrees = 0 ;
+const int el_backlash_degrees = 0 ;
+const int az_approach = 0 ;
+const int el_approach = 0 ;
 // ---- future config values could add.. ----
 // const int mag_decl_degrees = 10 ; // added to magnetic heading to get true north
 const long serial_port_speed = 115200 ;
@@ -27,6 +34,56 @@ const int millis_correction = 8 ;
 // Magnetometer sometimes returns strange values, this sets limit to how many we'll accept
 const int max_heading_degrees_change_allowed = 20 ; // If we exceed previous value by this much, ignore/error
 const int max_heading_errors_allowed = 30 ; // Start accepting values after this many times
+// Motor currents disturb the magnetometer (see magcal.cpp), so hold the heading for this long
+// after a motor starts, stops or reverses
+const int mag_blank_msecs = 150 ;
+
+// Binary trace recording, record every Nth rotator update, 0 = off
+// Can be changed at runtime with the CLI 'r' cmd, 1 is needed for exact replay
+const int trace_startup_decimation = 0 ;
+
+// Binary debug log (see debuglog.cpp), always logged into a RAM ring of this many events
+// (a power of 2, 9 bytes each), and sent as they are logged if streaming
+// Streaming can be changed at runtime with the CLI 'l' cmd
+const byte debuglog_entries = 16 ;
+const bool debuglog_startup_streaming = false ;
+
+// Multi-drop binary protocol for several rotators on one serial bus (see serial.cpp)
+// Each rotator's address is set with the multi-drop set address cmd and saved in EEPROM
+const int multidrop_default_address = 1 ; // used until an address is saved
+const int multidrop_slot_msecs = 10 ; // reply slot per address for broadcast polls
+const int rs485_direction_pin = -1 ; // RS-485 transceiver DE/RE pin, e.g. 2, -1 = not used
+
+// Identification/tuning routine (see tuning.cpp) won't move an axis further than this from
+// where it started each test, or closer than the margin to the elevation limits or the
+// azimuth wrap at +/-180
+const int tuning_max_travel_degrees = 60 ;
+const int tuning_margin_degrees = 5 ;
+
+// Stall/obstruction detection (see fault.cpp), an axis driven for this long has to move at
+// least the stall degrees, and not driven it mustn't move more than the runaway degrees
+const int fault_window_msecs = 2000 ;
+const int fault_stall_degrees = 2 ;
+const int fault_runaway_degrees = 5 ;
+
+// Low power idle (see power.cpp), once stopped for this long only update the rotator this
+// often, with the sensors in low power and the MCU sleeping in between
+const long idle_after_msecs = 5000 ;
+const int idle_update_msecs = 250 ;
+
+// Sun/moon tracking (see track.cpp), a new target is worked out this often, and each pass is
+// planned ahead in steps, skipping the short end of a pass that crosses the azimuth wrap (south)
+// rather than spending the unwind time to follow it
+const int track_update_msecs = 1000 ;
+const int track_plan_step_secs = 300 ;
+const long track_plan_secs = 86400 ; // how far ahead to look for the body rising/setting
+const int track_unwind_secs = 90 ; // time to turn the azimuth all the way round
+
+// EEPROM layout for settings saved on the rotator
+const int eeprom_multidrop_address = 0 ; // 1 byte
+const int eeprom_tuning = 1 ; // 1 byte valid marker + 2 x rotator_axis_tuning
+const int eeprom_track_site = 24 ; // 1 byte valid marker + track_site
+const int eeprom_magcal = 35 ; // 1 byte valid marker + magnetometer offset table (48 bytes)
 
 // How long to lockout movement for after E stop if still receiving targets
 const long movement_disabled_lockout_millis = 10000 ;
@@ -0,0 +1,99 @@
+// Functions related to the binary debug log
+// rototor_areg
+// VK5CD
+//
+// The ring keeps the most recent debuglog_entries events. Events not sent by
+// the time the ring wraps round are overwritten, and counted in the next one
+// sent. When not streaming the ring still fills, so the last events before a
+// fault can be sent afterwards with the CLI 'l' cmd.
+
+#include <Arduino.h>
+
+#include "debuglog.h"
+#include "config.h"
+#include "trace.h"
+
+struct debuglog_entry
+{
+  uint8_t id;
+  uint16_t msecs;
+  int16_t args[3];
+} __attribute__((packed));
+
+debuglog_entry debuglog_ring[debuglog_entries] ;
+byte debuglog_head = 0 ;          // next entry to log into
+byte debuglog_count = 0 ;         // entries not yet sent
+byte debuglog_lost = 0 ;          // overwritten since the last one sent
+bool debuglog_streaming = debuglog_startup_streaming ;
+bool debuglog_dumping = false ;   // sending what is in the ring, once
+
+// Log an event, cheap enough to call from anywhere in the loop
+// (but not from an interrupt)
+void debuglog_event(byte id, int arg1, int arg2, int arg3)
+{
+  debuglog_entry * entry = &debuglog_ring[debuglog_head] ;
+
+  entry->id = id ;
+  entry->msecs = millis() / millis_correction ;
+  entry->args[0] = arg1 ;
+  entry->args[1] = arg2 ;
+  entry->args[2] = arg3 ;
+  debuglog_head = ( debuglog_head + 1 ) & ( debuglog_entries - 1 ) ;
+
+  if ( debuglog_count < debuglog_entries )
+    debuglog_count ++ ;
+  else if ( debuglog_lost < 255 )
+    debuglog_lost ++ ;
+}
+
+// Send events as they are logged, or not
+void debuglog_set_streaming(bool streaming)
+{
+  debuglog_streaming = streaming ;
+  debuglog_dumping = false ;
+}
+
+bool debuglog_get_streaming()
+{
+  return debuglog_streaming ;
+}
+
+// Send whatever is in the ring, once
+void debuglog_dump()
+{
+  debuglog_dumping = true ;
+}
+
+// Send as many events, oldest first, as there is room for, called every loop
+//
+// MUST NOT BLOCK AS WILL INTERFERE WITH MOTOR CONTROL!
+//
+void debuglog_drain()
+{
+  debuglog_record record ;
+  int room ;
+
+  if ( ! debuglog_streaming && ! debuglog_dumping )
+    return ;
+
+  // Leave room for the next trace record, it matters more for replay
+  room = Serial.availableForWrite() - trace_next_record_size() ;
+
+  while ( debuglog_count > 0 && room >= int(sizeof(record) + trace_frame_overhead) )
+  {
+    const debuglog_entry * entry = &debuglog_ring[( debuglog_head - debuglog_count ) & ( debuglog_entries - 1 )] ;
+
+    record.id = entry->id ;
+    record.msecs = entry->msecs ;
+    memcpy(record.args, entry->args, sizeof(record.args));
+    record.lost = debuglog_lost ;
+    trace_send_record(trace_type_log, (byte *)&record, sizeof(record)) ;
+
+    debuglog_lost = 0 ;
+    debuglog_count -- ;
+    room -= sizeof(record) + trace_frame_overhead ;
+  }
+
+  if ( debuglog_count == 0 )
+    debuglog_dumping = false ;
+}
@@ -0,0 +1,37 @@
+// Functions related to the binary debug log
+// rototor_areg
+// VK5CD
+//
+// Debug events are logged as an ID, a timestamp and a few integer arguments
+// into a small RAM ring, which takes a few cycles and never touches the serial
+// port, so logging is always on without changing the loop timing. The ring is
+// drained as trace framed records (see trace.h) when there is room in the
+// serial tx buffer, and python/debuglog.py turns them back into text. The
+// format strings live only on the host, keyed by the event IDs below.
+
+#include <Arduino.h>
+
+// Event IDs, must match python/debuglog.py
+const byte debuglog_heading_error = 1 ;   // errors in a row, rejected heading, heading kept
+const byte debuglog_el_ramp = 2 ;         // ramp start: wanted pwm, pwm, first pwm change (x pwm_scale)
+const byte debuglog_el_ramp_done = 3 ;    // pwm, pitch, target pitch
+const byte debuglog_az_ramp = 4 ;         // ramp start: wanted pwm, pwm, first pwm change (x pwm_scale)
+const byte debuglog_az_ramp_done = 5 ;    // pwm, heading, target heading
+const byte debuglog_fault = 6 ;           // fault code (see fault.h), heading, pitch
+const byte debuglog_identify = 7 ;        // result (see tuning.h), axis, 0
+const byte debuglog_magcal = 8 ;          // result (see magcal.h), axis, pulses rejected as it moved
+
+// Log record payload, one event
+struct debuglog_record
+{
+  uint8_t id;
+  uint16_t msecs;            // when logged, millis corrected, wraps every 65 secs
+  int16_t args[3];
+  uint8_t lost;              // events before this one overwritten before they were sent
+} __attribute__((packed));
+
+void debuglog_event(byte id, int arg1, int arg2, int arg3);
+void debuglog_set_streaming(bool streaming);
+bool debuglog_get_streaming();
+void debuglog_dump();
+void debuglog_drain();
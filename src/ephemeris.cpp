@@ -0,0 +1,247 @@
+// Functions related to finding where the sun and moon are
+// rototor_areg
+// VK5CD
+//
+// Angles are binary, 2^32 (or 2^16 for the trig) = 360 degrees, so they wrap
+// for free. Each angle that moves with time is a0 + rate * secs, with the rate
+// in 2^-15 units per second so 64 bit maths keeps it exact for decades.
+// Sines/cosines are 16384 = 1.0.
+//
+// Sun:  longitude from its mean longitude and anomaly, latitude 0
+// Moon: the main periodic terms for longitude, latitude and parallax
+// Both are then turned into a vector, rotated from ecliptic to equatorial,
+// by the sidereal time to the observer's meridian, and up to their horizon.
+// Times are UTC (the ~70 secs to TT doesn't matter at this precision), and
+// positions are geometric, no refraction.
+
+#include <Arduino.h>
+#include "ephemeris.h"
+
+// A term of the series, amplitude * sin(a0 + rate * secs)
+struct ephemeris_term
+{
+  uint32_t a0;      // 2^32 = 360 degrees
+  int32_t rate;     // 2^-15 units of a0 per second
+  int16_t amp;      // 2^18 = 360 degrees
+};
+
+// Sun mean longitude
+const uint32_t ephemeris_sun_a0 = 0xC7702F55UL ; // 280.460
+const int32_t ephemeris_sun_rate = 4459797 ;     // 0.9856474 degrees/day
+
+const ephemeris_term ephemeris_sun_longitude[] PROGMEM = {
+  { 0xFE3DFC73UL, 4459584, 1394 }, // +1.915 sin(357.528 + 35999.05T)
+  { 0xFC7BF8E6UL, 8919169, 15 },   // +0.020 sin(2 x 357.528 + 71998.10T)
+};
+
+// Moon mean longitude
+const uint32_t ephemeris_moon_a0 = 0x9B3FF170UL ; // 218.32
+const int32_t ephemeris_moon_rate = 59619758 ;    // 481267.881 degrees/century
+
+const ephemeris_term ephemeris_moon_longitude[] PROGMEM = {
+  { 0x60000000UL, 59115686, 4580 },   // +6.29 sin(135.0 + 477198.87T)
+  { 0xB8641FDCUL, -51204236, -925 },  // -1.27 sin(259.3 - 413335.36T)
+  { 0xA79BE024UL, 110319921, 481 },   // +0.66 sin(235.7 + 890534.22T)
+  { 0xBFEDCBAAUL, 118231372, 153 },   // +0.21 sin(269.9 + 954397.74T)
+  { 0xFE38E38EUL, 4459584, -138 },    // -0.19 sin(357.5 + 35999.05T)
+  { 0x849F49F5UL, 119718719, -80 },   // -0.11 sin(186.5 + 966404.03T)
+};
+
+const ephemeris_term ephemeris_moon_latitude[] PROGMEM = {
+  { 0x4258BF26UL, 59859360, 3736 },   // +5.13 sin(93.3 + 483202.02T)
+  { 0xA2468ACFUL, 118975046, 204 },   // +0.28 sin(228.2 + 960400.89T)
+  { 0xE258BF26UL, 743674, -204 },     // -0.28 sin(318.3 + 6003.15T)
+  { 0x9ABCDF01UL, -50460562, -124 },  // -0.17 sin(217.6 - 407332.21T)
+};
+
+// Horizontal parallax, the cosine terms as sines 90 degrees on
+const int16_t ephemeris_moon_parallax_mean = 692 ; // 0.9508
+const ephemeris_term ephemeris_moon_parallax[] PROGMEM = {
+  { 0xA0000000UL, 59115686, 38 },     // +0.0518 cos(135.0 + 477198.87T)
+  { 0xF8641FDCUL, -51204236, 7 },     // +0.0095 cos(259.3 - 413335.36T)
+  { 0xE79BE024UL, 110319921, 6 },     // +0.0078 cos(235.7 + 890534.22T)
+  { 0xFFEDCBAAUL, 118231372, 2 },     // +0.0028 cos(269.9 + 954397.74T)
+};
+
+// Greenwich mean sidereal time
+const uint32_t ephemeris_gmst_a0 = 0xC7704C26UL ; // 280.46061837
+const int32_t ephemeris_gmst_rate = 1633365913 ;  // 360.98564736629 degrees/day
+
+// Obliquity of the ecliptic, 23.439 degrees (changes < 0.01 degrees over decades)
+const uint16_t ephemeris_obliquity = 4267 ;
+
+// sin() for 0..90 degrees in 64 steps
+const int16_t ephemeris_sin_table[65] PROGMEM = {
+  0, 402, 804, 1205, 1606, 2006, 2404, 2801, 3196, 3590, 3981, 4370, 4756,
+  5139, 5520, 5897, 6270, 6639, 7005, 7366, 7723, 8076, 8423, 8765, 9102,
+  9434, 9760, 10080, 10394, 10702, 11003, 11297, 11585, 11866, 12140, 12406,
+  12665, 12916, 13160, 13395, 13623, 13842, 14053, 14256, 14449, 14635,
+  14811, 14978, 15137, 15286, 15426, 15557, 15679, 15791, 15893, 15986,
+  16069, 16143, 16207, 16261, 16305, 16340, 16364, 16379, 16384
+};
+
+// atan() for 0..1 in 64 steps, 2^16 = 360 degrees
+const int16_t ephemeris_atan_table[65] PROGMEM = {
+  0, 163, 326, 489, 651, 813, 975, 1136, 1297, 1457, 1617, 1775, 1933, 2090,
+  2246, 2401, 2555, 2708, 2860, 3010, 3159, 3307, 3453, 3599, 3742, 3884,
+  4025, 4164, 4302, 4438, 4572, 4705, 4836, 4966, 5094, 5220, 5344, 5467,
+  5589, 5708, 5826, 5943, 6058, 6171, 6282, 6392, 6500, 6607, 6712, 6815,
+  6917, 7018, 7117, 7214, 7310, 7405, 7498, 7589, 7679, 7768, 7856, 7942,
+  8026, 8110, 8192
+};
+
+// Look up a table with linear interpolation, index is 0..16384 for the whole table
+int16_t ephemeris_lookup(const int16_t * table, uint16_t index)
+{
+  byte i = index >> 8 ;
+  int16_t low = pgm_read_word(&table[i]) ;
+  if ( i == 64 )
+    return low ;
+  int16_t high = pgm_read_word(&table[i + 1]) ;
+  return low + ( ( (long)( high - low ) * ( index & 0xFF ) ) >> 8 ) ;
+}
+
+int16_t ephemeris_sin(uint16_t angle)
+{
+  uint16_t quarter = angle & 0x3FFF ;
+  if ( angle & 0x4000 )
+    quarter = 0x4000 - quarter ; // 2nd and 4th quadrants mirror the 1st
+  int16_t value = ephemeris_lookup(ephemeris_sin_table, quarter) ;
+  return ( angle & 0x8000 ) ? - value : value ;
+}
+
+int16_t ephemeris_cos(uint16_t angle)
+{
+  return ephemeris_sin(angle + 0x4000) ;
+}
+
+// Angle of (x,y), x and y less than 2^17
+uint16_t ephemeris_atan2(long y, long x)
+{
+  unsigned long ax = x < 0 ? -x : x ;
+  unsigned long ay = y < 0 ? -y : y ;
+  uint16_t angle ;
+
+  if ( ax == 0 && ay == 0 )
+    return 0 ;
+  if ( ay <= ax )
+    angle = ephemeris_lookup(ephemeris_atan_table, ( ay << 14 ) / ax) ;
+  else
+    angle = 0x4000 - ephemeris_lookup(ephemeris_atan_table, ( ax << 14 ) / ay) ;
+
+  if ( x < 0 )
+    angle = 0x8000 - angle ;
+  if ( y < 0 )
+    angle = - angle ;
+  return angle ;
+}
+
+uint16_t ephemeris_sqrt(unsigned long value)
+{
+  unsigned long root = 0 ;
+  unsigned long bit = 1UL << 30 ;
+
+  while ( bit > value )
+    bit >>= 2 ;
+  while ( bit )
+  {
+    if ( value >= root + bit )
+    {
+      value -= root + bit ;
+      root = ( root >> 1 ) + bit ;
+    }
+    else
+      root >>= 1 ;
+    bit >>= 2 ;
+  }
+  return root ;
+}
+
+// Angle a0 + rate * secs
+uint32_t ephemeris_angle(uint32_t a0, int32_t rate, long secs)
+{
+  return a0 + (uint32_t)( ( (int64_t)rate * secs ) >> 15 ) ;
+}
+
+// Sum of a series of terms, 2^32 = 360 degrees
+long ephemeris_series(const ephemeris_term * terms, byte count, long secs)
+{
+  ephemeris_term term ;
+  long sum = 0 ;
+
+  for ( byte i = 0 ; i < count ; i++ )
+  {
+    memcpy_P(&term, &terms[i], sizeof(term));
+    sum += (long)term.amp * ephemeris_sin(ephemeris_angle(term.a0, term.rate, secs) >> 16) ;
+  }
+  return sum ;
+}
+
+// Latitude and longitude in 0.001 degrees, north and east positive
+void ephemeris_set_site(long latitude, long longitude, ephemeris_site * site)
+{
+  // 2^32 / 360000 in 2^-16 units
+  uint16_t lat = ( (int64_t)latitude * 781874936 ) >> 32 ;
+  site->sin_lat = ephemeris_sin(lat) ;
+  site->cos_lat = ephemeris_cos(lat) ;
+  site->longitude = ( (int64_t)longitude * 781874936 ) >> 16 ;
+}
+
+// Azimuth (0 = true north, clockwise) and elevation of the body at the time
+// (secs since J2000.0) from the site, both in 0.1 degrees
+void ephemeris_position(byte body, long secs, const ephemeris_site * site, int * azimuth, int * elevation)
+{
+  uint32_t longitude ;
+  long latitude = 0 ;
+  long parallax = 0 ;
+
+  if ( body == ephemeris_moon )
+  {
+    longitude = ephemeris_angle(ephemeris_moon_a0, ephemeris_moon_rate, secs)
+                + ephemeris_series(ephemeris_moon_longitude, sizeof(ephemeris_moon_longitude) / sizeof(ephemeris_term), secs) ;
+    latitude = ephemeris_series(ephemeris_moon_latitude, sizeof(ephemeris_moon_latitude) / sizeof(ephemeris_term), secs) ;
+    parallax = ( (long)ephemeris_moon_parallax_mean << 14 )
+               + ephemeris_series(ephemeris_moon_parallax, sizeof(ephemeris_moon_parallax) / sizeof(ephemeris_term), secs) ;
+  }
+  else
+  {
+    longitude = ephemeris_angle(ephemeris_sun_a0, ephemeris_sun_rate, secs)
+                + ephemeris_series(ephemeris_sun_longitude, sizeof(ephemeris_sun_longitude) / sizeof(ephemeris_term), secs) ;
+  }
+
+  // Unit vector, ecliptic
+  uint16_t lon = longitude >> 16 ;
+  uint16_t lat = (uint32_t)latitude >> 16 ;
+  long cos_lat = ephemeris_cos(lat) ;
+  long x = ( cos_lat * ephemeris_cos(lon) ) >> 14 ;
+  long y = ( cos_lat * ephemeris_sin(lon) ) >> 14 ;
+  long z = ephemeris_sin(lat) ;
+
+  // Equatorial
+  long sin_e = ephemeris_sin(ephemeris_obliquity) ;
+  long cos_e = ephemeris_cos(ephemeris_obliquity) ;
+  long y_eq = ( y * cos_e - z * sin_e ) >> 14 ;
+  long z_eq = ( y * sin_e + z * cos_e ) >> 14 ;
+
+  // Local hour angle, x towards the meridian, y east
+  uint16_t sidereal = ( ephemeris_angle(ephemeris_gmst_a0, ephemeris_gmst_rate, secs) + site->longitude ) >> 16 ;
+  long sin_st = ephemeris_sin(sidereal) ;
+  long cos_st = ephemeris_cos(sidereal) ;
+  long x_ha = ( x * cos_st + y_eq * sin_st ) >> 14 ;
+  long east = ( y_eq * cos_st - x * sin_st ) >> 14 ;
+
+  // Horizon
+  long north = ( z_eq * site->cos_lat - x_ha * site->sin_lat ) >> 14 ;
+  long up = ( z_eq * site->sin_lat + x_ha * site->cos_lat ) >> 14 ;
+
+  uint16_t az = ephemeris_atan2(east, north) ;
+  int16_t el = ephemeris_atan2(up, ephemeris_sqrt(east * east + north * north)) ;
+
+  // Seen from the earth's surface rather than its centre the moon is lower
+  el -= ( ( parallax >> 16 ) * ephemeris_cos(el) ) >> 14 ;
+
+  *azimuth = ( (uint32_t)az * 3600 + 0x8000 ) >> 16 ;
+  if ( *azimuth == 3600 )
+    *azimuth = 0 ;
+  *elevation = ( (long)el * 3600 + 0x8000 ) >> 16 ;
+}
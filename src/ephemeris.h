@@ -0,0 +1,29 @@
+// Functions related to finding where the sun and moon are
+// rototor_areg
+// VK5CD
+//
+// Low precision ephemeris (as in the Astronomical Almanac), all fixed point
+// as the AVR has no floating point hardware. Good to 0.1 degrees for
+// the sun and 0.5 degrees for the moon, checked against a more accurate host
+// reference by python/ephemeris_check.py
+
+#include <Arduino.h>
+
+// Bodies that can be tracked
+const byte ephemeris_sun = 1 ;
+const byte ephemeris_moon = 2 ;
+
+// Unix time of the J2000.0 epoch (2000-01-01 12:00 UTC), ephemeris times are
+// seconds since this
+const unsigned long ephemeris_j2000_unix = 946728000UL ;
+
+// Observer's site, worked out once by ephemeris_set_site()
+struct ephemeris_site
+{
+  int16_t sin_lat;     // 16384 = 1.0
+  int16_t cos_lat;
+  uint32_t longitude;  // east, 2^32 = 360 degrees
+};
+
+void ephemeris_set_site(long latitude, long longitude, ephemeris_site * site);
+void ephemeris_position(byte body, long secs, const ephemeris_site * site, int * azimuth, int * elevation);
@@ -0,0 +1,220 @@
+// Functions related to detecting an axis not moving as its motor is driven
+// rototor_areg
+// VK5CD
+//
+// The window is split into slots, each remembering the axis position at its
+// start and how the motor was driven through it, with a count of each kind of
+// slot kept as they are added and dropped. So each check is the same small
+// amount of work however long the window.
+
+#include <Arduino.h>
+
+#include "fault.h"
+#include "config.h"
+#include "rotator.h"
+
+const int fault_slot_msecs = fault_window_msecs / fault_slots ;
+
+// How the motor was driven through a slot
+const byte fault_drive_mixed = 0 ;   // changed, or only partly driven
+const byte fault_drive_forward = 1 ; // clockwise/pitch up
+const byte fault_drive_back = 2 ;    // anti-clockwise/pitch down
+const byte fault_drive_off = 3 ;
+
+struct fault_axis
+{
+  int16_t last ;                      // last heading/pitch seen, 0.1 degrees
+  int16_t position ;                  // unwrapped 0.1 degrees, only differences matter so can overflow
+  int16_t slot_positions[fault_slots] ;
+  byte slot_drives[fault_slots] ;
+  byte drive ;                        // through the current slot so far
+  byte drive_counts[4] ;              // of each drive in the window
+};
+
+fault_axis fault_axes[2] = {
+  { 0, 0, { 0 }, { fault_drive_mixed }, fault_drive_mixed, { fault_slots, 0, 0, 0 } },
+  { 0, 0, { 0 }, { fault_drive_mixed }, fault_drive_mixed, { fault_slots, 0, 0, 0 } }
+};
+byte fault_slot = 0 ;                 // current slot
+long fault_slot_start_msecs = 0 ;
+byte fault = fault_none ;
+byte fault_version = 0 ;              // see fault_window_version()
+
+// How a pwm drives the axis. It is only partly driven while the pwm is still
+// easing to where it is going (ramping, or taking up backlash), or is in the
+// deadband (under the tuning min_pwm)
+byte fault_drive(byte axis, int pwm, bool easing)
+{
+  rotator_axis_tuning tuning ;
+  rotator_get_tuning(axis, &tuning);
+
+  if ( pwm == 0 )
+    return fault_drive_off ;
+  if ( easing )
+    return fault_drive_mixed ;
+  if ( pwm >= tuning.min_pwm )
+    return fault_drive_forward ;
+  if ( pwm <= - tuning.min_pwm )
+    return fault_drive_back ;
+  return fault_drive_mixed ;
+}
+
+// Update one axis, returning any fault seen over the window (0 = none,
+// otherwise 1 stall, 2 reversed, 3 runaway)
+byte fault_axis_update(byte axis, int pos, int pwm, bool easing, bool slot_done)
+{
+  fault_axis * a = &fault_axes[axis] ;
+  byte result = 0 ;
+
+  // Heading wraps around
+  int change = pos - a->last ;
+  if ( axis == rotator_axis_az )
+  {
+    if ( change > 1800 ) change -= 3600 ;
+    if ( change < -1800 ) change += 3600 ;
+  }
+  a->last = pos ;
+  a->position += change ;
+
+  byte drive = fault_drive(axis, pwm, easing) ;
+  if ( ! slot_done )
+  {
+    if ( drive != a->drive )
+      a->drive = fault_drive_mixed ;
+    return 0 ;
+  }
+
+  // Current slot done, it replaces the oldest in the window
+  a->drive_counts[a->slot_drives[fault_slot]] -- ;
+  a->slot_drives[fault_slot] = a->drive ;
+  a->drive_counts[a->drive] ++ ;
+
+  // Window runs from the start of the oldest slot until now
+  byte oldest = ( fault_slot + 1 ) % fault_slots ;
+  int16_t travel = a->position - a->slot_positions[oldest] ;
+
+  if ( a->drive_counts[fault_drive_forward] == fault_slots || a->drive_counts[fault_drive_back] == fault_slots )
+  {
+    if ( a->drive_counts[fault_drive_back] == fault_slots )
+      travel = - travel ;
+    if ( travel <= - fault_stall_degrees * 10 )
+      result = 2 ;
+    else if ( travel < fault_stall_degrees * 10 )
+      result = 1 ;
+  }
+  else if ( a->drive_counts[fault_drive_off] == fault_slots && abs(travel) > fault_runaway_degrees * 10 )
+  {
+    result = 3 ;
+  }
+
+  // Start of the next slot
+  a->slot_positions[oldest] = a->position ;
+  a->drive = drive ;
+  return result ;
+}
+
+// Check both axes for one rotator_update(), with the motor pwm it set and
+// whether each is still easing to the pwm wanted (see fault_drive())
+// Returns a new fault, or fault_none
+//
+// MUST NOT BLOCK AS WILL INTERFERE WITH SERIAL COMMANDS!
+//
+byte fault_update(long cur_msecs, int heading, int pitch, int az_pwm, int el_pwm, bool az_easing, bool el_easing)
+{
+  bool slot_done = cur_msecs - fault_slot_start_msecs >= fault_slot_msecs ;
+  byte az = fault_axis_update(rotator_axis_az, heading, az_pwm, az_easing, slot_done) ;
+  byte el = fault_axis_update(rotator_axis_el, pitch, el_pwm, el_easing, slot_done) ;
+
+  if ( slot_done )
+  {
+    fault_slot = ( fault_slot + 1 ) % fault_slots ;
+    fault_slot_start_msecs = cur_msecs ;
+    fault_version ++ ;
+  }
+
+  // Keep the first fault until cleared
+  if ( fault != fault_none || ( az == 0 && el == 0 ) )
+    return fault_none ;
+
+  fault = az ? fault_az_stall - 1 + az : fault_el_stall - 1 + el ;
+  return fault ;
+}
+
+byte fault_code()
+{
+  return fault ;
+}
+
+const __FlashStringHelper * fault_name(byte code)
+{
+  switch ( code )
+  {
+    case fault_az_stall: return F("az stall");
+    case fault_az_reversed: return F("az reversed");
+    case fault_az_runaway: return F("az runaway");
+    case fault_el_stall: return F("el stall");
+    case fault_el_reversed: return F("el reversed");
+    case fault_el_runaway: return F("el runaway");
+  }
+  return F("none");
+}
+
+void fault_clear()
+{
+  fault = fault_none ;
+  fault_version ++ ;
+}
+
+// Changes whenever the fault_window_state does
+byte fault_window_version()
+{
+  return fault_version ;
+}
+
+void fault_save_window(fault_window_state * state)
+{
+  for ( byte axis = 0 ; axis < 2 ; axis++ )
+  {
+    memcpy(state->slot_positions[axis], fault_axes[axis].slot_positions, sizeof(state->slot_positions[axis]));
+    memcpy(state->slot_drives[axis], fault_axes[axis].slot_drives, sizeof(state->slot_drives[axis]));
+  }
+  state->slot = fault_slot ;
+  state->slot_start_msecs = fault_slot_start_msecs ;
+  state->fault = fault ;
+}
+
+void fault_restore_window(const fault_window_state * state)
+{
+  for ( byte axis = 0 ; axis < 2 ; axis++ )
+  {
+    fault_axis * a = &fault_axes[axis] ;
+    memcpy(a->slot_positions, state->slot_positions[axis], sizeof(a->slot_positions));
+    memcpy(a->slot_drives, state->slot_drives[axis], sizeof(a->slot_drives));
+    memset(a->drive_counts, 0, sizeof(a->drive_counts));
+    for ( byte slot = 0 ; slot < fault_slots ; slot++ )
+      a->drive_counts[a->slot_drives[slot]] ++ ;
+  }
+  fault_slot = state->slot ;
+  fault_slot_start_msecs = state->slot_start_msecs ;
+  fault = state->fault ;
+}
+
+// The position and drive so far through the current slot, for the rotator_state
+int fault_update_position(byte axis)
+{
+  return fault_axes[axis].position ;
+}
+
+byte fault_update_drive(byte axis)
+{
+  return fault_axes[axis].drive ;
+}
+
+// Restore what fault_update_position() and fault_update_drive() returned,
+// with the last heading/pitch seen
+void fault_restore_update(byte axis, int position, byte drive, int last)
+{
+  fault_axes[axis].position = position ;
+  fault_axes[axis].drive = drive ;
+  fault_axes[axis].last = last ;
+}
@@ -0,0 +1,52 @@
+// Functions related to detecting an axis not moving as its motor is driven
+// rototor_areg
+// VK5CD
+//
+// Each axis is checked over a sliding window (fault_window_msecs), and a
+// fault raised if for the whole window it was
+//   - driven, but moved less than fault_stall_degrees (stall, e.g. ice, a
+//     snagged cable or an end stop)
+//   - driven, but moved at least that far the wrong way (reversed, e.g. the
+//     motor wired backwards or the antenna back driven by wind)
+//   - not driven, but moved more than fault_runaway_degrees (runaway, e.g.
+//     a motor driver stuck on)
+// A fault stays set, and new targets are refused, until it is cleared by the
+// CLI 'fc' cmd or the multi-drop clear fault cmd.
+
+#include <Arduino.h>
+
+// Fault codes
+const byte fault_none = 0 ;
+const byte fault_az_stall = 1 ;
+const byte fault_az_reversed = 2 ;
+const byte fault_az_runaway = 3 ;
+const byte fault_el_stall = 4 ;
+const byte fault_el_reversed = 5 ;
+const byte fault_el_runaway = 6 ;
+
+// The window is split into this many slots, see fault.cpp
+const byte fault_slots = 8 ;
+
+// Window state for trace snapshots (see trace.h), packed with fixed size
+// types to be the same on the AVR and host. Only changes as a slot ends (or
+// a fault is set or cleared), which fault_window_version() counts. The rest
+// changes every update so goes in the rotator_state, see fault_update_position()
+struct fault_window_state
+{
+  int16_t slot_positions[2][fault_slots];
+  uint8_t slot_drives[2][fault_slots];
+  uint8_t slot;
+  int32_t slot_start_msecs;
+  uint8_t fault;
+} __attribute__((packed));
+
+byte fault_update(long cur_msecs, int heading, int pitch, int az_pwm, int el_pwm, bool az_easing, bool el_easing);
+byte fault_code();
+const __FlashStringHelper * fault_name(byte code);
+void fault_clear();
+byte fault_window_version();
+void fault_save_window(fault_window_state * state);
+void fault_restore_window(const fault_window_state * state);
+int fault_update_position(byte axis);
+byte fault_update_drive(byte axis);
+void fault_restore_update(byte axis, int position, byte drive, int last);
@@ -0,0 +1,391 @@
+// Functions related to compensating the magnetometer for the motor currents
+// rototor_areg
+// VK5CD
+//
+// For each axis and each pwm step, both ways, the calibration routine
+//   - settles with the motors stopped and takes the magnetometer sample
+//   - pulses the motor at the pwm, and takes the sample again at the end of
+//     the pulse
+// alternating the pulses each way so the axis ends up about where it started.
+// The change, averaged over the pulses, is the offset for that pwm.
+//
+// A pulse above the axis deadband (its tuning min_pwm) would turn the axis,
+// so pulses are kept under it, and the change at the first step above it is
+// scaled up for that and each higher step, as the disturbance goes with the
+// motor current, about in proportion to the pwm. So the deadband has to have
+// been identified first ('i').
+//
+// It is a state machine run from rotator_update(), so like it
+// MUST NOT BLOCK AS WILL INTERFERE WITH SERIAL COMMANDS!
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "magcal.h"
+#include "config.h"
+#include "rotator.h"
+#include "debuglog.h"
+
+// Calibration settings
+const int magcal_settle_msecs = 1000 ;  // motors stopped before each pulse
+const int magcal_pulse_msecs = 200 ;    // long enough for a new mag sample (15Hz)
+const byte magcal_pulses = 2 ;          // each way at each pwm step
+// A pulse is done again if the axis moved, seen as the settled samples
+// before and after it differing by more than these (0.1 uT, 0.01 m/s^2)
+const int magcal_moved_mag = 10 ;
+const int magcal_moved_accel = 20 ;
+const byte magcal_max_retries = 4 ;     // of a pulse before giving up
+// Pulses are kept this fraction (1/n) of the deadband under it, and a
+// deadband smaller than this is taken as not identified yet
+const byte magcal_deadband_margin = 8 ;
+const int magcal_min_deadband_pwm = 16 ;
+
+// EEPROM marker for saved offsets
+const byte magcal_eeprom_valid = 0x5A ;
+
+// Calibration phases
+const byte magcal_phase_idle = 0 ;
+const byte magcal_phase_settle = 1 ;
+const byte magcal_phase_pulse = 2 ;
+
+// Offsets for each axis motor, 0.1 uT, at each pwm step forward (clockwise/
+// pitch up) then each step back
+int8_t magcal_table[2][2 * magcal_steps][3] ;
+
+// Motor pwm as last set, and when one last started, stopped or reversed
+int magcal_pwms[2] ;
+long magcal_transient = - mag_blank_msecs ;
+
+// Offsets for each motor at its pwm as last set, so they are only worked out
+// when a pwm changes rather than for every sample
+int16_t magcal_offsets[2][3] ;
+
+// Routine state
+byte magcal_phase = magcal_phase_idle ;
+byte magcal_axes_todo ;        // magcal_axis_* bits still to do
+byte magcal_axis ;             // rotator_axis_* being calibrated
+byte magcal_step ;             // pwm step
+byte magcal_pulse ;            // even pulses forward, odd back
+int magcal_max_pulse_pwm ;     // just under the axis deadband
+long magcal_phase_start_msecs ;
+int16_t magcal_before[3] ;     // sample at the end of the settle
+int16_t magcal_before_accel[3] ;
+int16_t magcal_change[3] ;     // of the last pulse, until the settle after it shows the axis didn't move
+bool magcal_pending ;          // magcal_change not checked yet
+byte magcal_retries ;          // of the current pulse
+byte magcal_rejected ;         // pulses redone on this axis
+bool magcal_saturated ;        // an offset was clipped to fit the table
+int16_t magcal_sums[2][3] ;    // of the changes forward and back
+byte magcal_last_result = magcal_result_none ;
+
+void magcal_set_offsets();
+
+// Saved offsets, if there are any
+void magcal_setup()
+{
+  if ( EEPROM.read(eeprom_magcal) == magcal_eeprom_valid )
+    EEPROM.get(eeprom_magcal + 1, magcal_table);
+  magcal_set_offsets();
+}
+
+// Save the offsets to EEPROM, to be used from next reset
+void magcal_save()
+{
+  EEPROM.put(eeprom_magcal + 1, magcal_table);
+  EEPROM.update(eeprom_magcal, magcal_eeprom_valid);
+}
+
+// Forget the offsets, saved or not
+void magcal_clear()
+{
+  memset(magcal_table, 0, sizeof(magcal_table));
+  EEPROM.update(eeprom_magcal, 0xFF);
+  magcal_set_offsets();
+}
+
+// Called whenever a motor pwm is set (see motors.cpp)
+// Times are from the last rotator_update(), not millis(), so that commands in
+// between updates replay the same (see trace.h)
+void magcal_motor_pwm(byte axis, int pwm)
+{
+  int8_t dir = ( pwm > 0 ) - ( pwm < 0 ) ;
+  int8_t last_dir = ( magcal_pwms[axis] > 0 ) - ( magcal_pwms[axis] < 0 ) ;
+
+  if ( dir != last_dir )
+    magcal_transient = rotator_update_msecs() ;
+  if ( pwm != magcal_pwms[axis] )
+  {
+    magcal_pwms[axis] = pwm ;
+    magcal_offset(axis, pwm, magcal_offsets[axis]);
+  }
+}
+
+// True while the current through a motor that just started, stopped or
+// reversed is still settling, or while calibrating (with the samples not
+// compensated), so the heading can't be trusted
+bool magcal_blanking()
+{
+  return magcal_running() || rotator_update_msecs() - magcal_transient < mag_blank_msecs ;
+}
+
+// Motor transient state, for trace snapshots
+long magcal_transient_msecs()
+{
+  return magcal_transient ;
+}
+//
+void magcal_set_state(int az_pwm, int el_pwm, long transient_msecs)
+{
+  magcal_pwms[rotator_axis_az] = az_pwm ;
+  magcal_pwms[rotator_axis_el] = el_pwm ;
+  magcal_transient = transient_msecs ;
+  magcal_set_offsets();
+}
+
+// Pwm of a calibration step
+int magcal_step_to_pwm(byte step)
+{
+  return min(( step + 1 ) * magcal_step_pwm, 255) ;
+}
+
+// Offset an axis motor gives at a pwm, interpolated between the steps, 0.1 uT
+void magcal_offset(byte axis, int pwm, int16_t offset[3])
+{
+  byte first = pwm < 0 ? magcal_steps : 0 ;
+  int magnitude = min(abs(pwm), 255) ;
+  int lower_pwm = 0 ;
+  int16_t lower[3] = { 0, 0, 0 } ;
+
+  for ( byte step = 0 ; step < magcal_steps ; step++ )
+  {
+    int step_pwm = magcal_step_to_pwm(step) ;
+    const int8_t * upper = magcal_table[axis][first + step] ;
+    if ( magnitude <= step_pwm )
+    {
+      for ( byte i = 0 ; i < 3 ; i++ )
+        offset[i] = lower[i] + long( upper[i] - lower[i] ) * ( magnitude - lower_pwm ) / ( step_pwm - lower_pwm ) ;
+      return ;
+    }
+    for ( byte i = 0 ; i < 3 ; i++ )
+      lower[i] = upper[i] ;
+    lower_pwm = step_pwm ;
+  }
+}
+
+// Work out the offsets for both motors at their pwms, after the table changed
+void magcal_set_offsets()
+{
+  magcal_offset(rotator_axis_az, magcal_pwms[rotator_axis_az], magcal_offsets[rotator_axis_az]);
+  magcal_offset(rotator_axis_el, magcal_pwms[rotator_axis_el], magcal_offsets[rotator_axis_el]);
+}
+
+// Take the offsets for the motor pwms off a raw mag sample (see ahrs_read_raw())
+// Not while calibrating, which needs the uncompensated samples
+void magcal_compensate(int16_t mag[3])
+{
+  if ( magcal_running() )
+    return ;
+  for ( byte i = 0 ; i < 3 ; i++ )
+    mag[i] -= magcal_offsets[rotator_axis_az][i] + magcal_offsets[rotator_axis_el][i] ;
+}
+
+void magcal_start_phase(byte phase, long cur_msecs)
+{
+  magcal_phase = phase ;
+  magcal_phase_start_msecs = cur_msecs ;
+}
+
+// Kept for magcal_result() rather than printed, as it runs from rotator_update()
+void magcal_stop(byte result)
+{
+  magcal_phase = magcal_phase_idle ;
+  magcal_last_result = result ;
+  magcal_set_offsets();
+  debuglog_event(debuglog_magcal, result, magcal_axis, magcal_rejected);
+}
+
+// Start the next axis to do, or finish
+void magcal_start_axis(long cur_msecs)
+{
+  if ( magcal_axes_todo & magcal_axis_az )
+  {
+    magcal_axes_todo &= ~magcal_axis_az ;
+    magcal_axis = rotator_axis_az ;
+  }
+  else if ( magcal_axes_todo & magcal_axis_el )
+  {
+    magcal_axes_todo &= ~magcal_axis_el ;
+    magcal_axis = rotator_axis_el ;
+  }
+  else
+  {
+    magcal_stop(magcal_saturated ? magcal_result_saturated : magcal_result_done);
+    return ;
+  }
+
+  // Pulses have to stay under the deadband, so it has to be known
+  rotator_axis_tuning tuning ;
+  rotator_get_tuning(magcal_axis, &tuning);
+  if ( tuning.min_pwm < magcal_min_deadband_pwm )
+  {
+    magcal_stop(magcal_result_no_deadband);
+    return ;
+  }
+  magcal_max_pulse_pwm = tuning.min_pwm - tuning.min_pwm / magcal_deadband_margin ;
+
+  magcal_step = 0 ;
+  magcal_pulse = 0 ;
+  magcal_pending = false ;
+  magcal_retries = 0 ;
+  magcal_rejected = 0 ;
+  memset(magcal_sums, 0, sizeof(magcal_sums));
+  magcal_start_phase(magcal_phase_settle, cur_msecs);
+}
+
+// Start calibrating the given axes (magcal_axis_* bits), the caller has
+// already stopped the motors
+void magcal_start(byte axes, long cur_msecs)
+{
+  magcal_axes_todo = axes ;
+  magcal_saturated = false ;
+  magcal_start_axis(cur_msecs);
+}
+
+// Stop the routine, leaving the offsets as they were for any step not finished
+void magcal_abort()
+{
+  if ( magcal_phase != magcal_phase_idle )
+    magcal_stop(magcal_result_aborted);
+}
+
+bool magcal_running()
+{
+  return magcal_phase != magcal_phase_idle ;
+}
+
+// How the last calibration ended, or magcal_result_running
+byte magcal_result()
+{
+  return magcal_running() ? magcal_result_running : magcal_last_result ;
+}
+
+const __FlashStringHelper * magcal_result_name(byte result)
+{
+  switch ( result )
+  {
+    case magcal_result_running: return F("running");
+    case magcal_result_done: return F("done");
+    case magcal_result_aborted: return F("aborted");
+    case magcal_result_saturated: return F("done, some offsets clipped at +/-12.7 uT");
+    case magcal_result_moved: return F("failed, axis kept moving with the pulses");
+    case magcal_result_no_deadband: return F("failed, deadband (min pwm) not known, identify with 'i' first");
+  }
+  return F("not run");
+}
+
+// Pwm to pulse the motor at for this step, kept under the deadband
+int magcal_pulse_pwm()
+{
+  return min(magcal_step_to_pwm(magcal_step), magcal_max_pulse_pwm) ;
+}
+
+// All the pulses at a step done, so set its offsets from them, scaled up to
+// the step pwm if the pulses were kept under the deadband. Then the higher
+// steps are scaled from the same pulses, so it skips to the last step.
+// Any too big for the table are clipped, and reported in the result
+void magcal_finish_step()
+{
+  int pulse_pwm = magcal_pulse_pwm() ;
+  byte last = magcal_step_to_pwm(magcal_step) > pulse_pwm ? magcal_steps - 1 : magcal_step ;
+
+  for ( byte step = magcal_step ; step <= last ; step++ )
+    for ( byte dir = 0 ; dir < 2 ; dir++ )
+      for ( byte i = 0 ; i < 3 ; i++ )
+      {
+        long offset = long(magcal_sums[dir][i]) * magcal_step_to_pwm(step) / ( magcal_pulses * pulse_pwm ) ;
+        if ( offset < -127 || offset > 127 )
+          magcal_saturated = true ;
+        magcal_table[magcal_axis][dir * magcal_steps + step][i] = constrain(offset, -127L, 127L) ;
+      }
+  magcal_step = last ;
+  memset(magcal_sums, 0, sizeof(magcal_sums));
+}
+
+// True if the settled samples either side of a pulse differ, so the axis
+// moved and the change was not just the motor current
+bool magcal_moved(const int16_t accel[3], const int16_t mag[3])
+{
+  for ( byte i = 0 ; i < 3 ; i++ )
+    if ( abs(mag[i] - magcal_before[i]) > magcal_moved_mag || abs(accel[i] - magcal_before_accel[i]) > magcal_moved_accel )
+      return true ;
+  return false ;
+}
+
+// Settled after a pulse, so count it if the axis didn't move, otherwise it
+// is done again. Returns false once the routine has moved on from the axis.
+bool magcal_check_pulse(long cur_msecs, const int16_t accel[3], const int16_t mag[3])
+{
+  magcal_pending = false ;
+  if ( magcal_moved(accel, mag) )
+  {
+    magcal_rejected ++ ;
+    if ( ++magcal_retries > magcal_max_retries )
+    {
+      magcal_stop(magcal_result_moved);
+      return false ;
+    }
+    return true ;
+  }
+
+  magcal_retries = 0 ;
+  for ( byte i = 0 ; i < 3 ; i++ )
+    magcal_sums[magcal_pulse & 1][i] += magcal_change[i] ;
+  if ( ++magcal_pulse == 2 * magcal_pulses )
+  {
+    magcal_finish_step();
+    magcal_pulse = 0 ;
+    if ( ++magcal_step == magcal_steps )
+    {
+      magcal_start_axis(cur_msecs);
+      return false ;
+    }
+  }
+  return true ;
+}
+
+// Run the routine for one rotator_update(), with the raw (uncompensated)
+// accel and mag samples, returning the motor pwm to set
+void magcal_update(long cur_msecs, const int16_t accel[3], const int16_t mag[3], int * az_pwm, int * el_pwm)
+{
+  long elapsed = cur_msecs - magcal_phase_start_msecs ;
+  int pwm = 0 ;
+
+  switch ( magcal_phase )
+  {
+    case magcal_phase_settle:
+      if ( elapsed >= magcal_settle_msecs )
+      {
+        if ( magcal_pending && ! magcal_check_pulse(cur_msecs, accel, mag) )
+          break;
+        memcpy(magcal_before, mag, sizeof(magcal_before));
+        memcpy(magcal_before_accel, accel, sizeof(magcal_before_accel));
+        magcal_start_phase(magcal_phase_pulse, cur_msecs);
+      }
+      break;
+
+    case magcal_phase_pulse:
+      if ( elapsed >= magcal_pulse_msecs )
+      {
+        for ( byte i = 0 ; i < 3 ; i++ )
+          magcal_change[i] = mag[i] - magcal_before[i] ;
+        magcal_pending = true ;
+        magcal_start_phase(magcal_phase_settle, cur_msecs);
+      }
+      break;
+  }
+
+  if ( magcal_phase == magcal_phase_pulse )
+    pwm = magcal_pulse & 1 ? - magcal_pulse_pwm() : magcal_pulse_pwm() ;
+  *az_pwm = magcal_axis == rotator_axis_az ? pwm : 0 ;
+  *el_pwm = magcal_axis == rotator_axis_el ? pwm : 0 ;
+}
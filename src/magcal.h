@@ -0,0 +1,47 @@
+// Functions related to compensating the magnetometer for the motor currents
+// rototor_areg
+// VK5CD
+//
+// The motor currents (and the L298N driving them) disturb the magnetometer,
+// with an offset that goes with each motor's pwm, and a glitch as a motor
+// starts, stops or reverses. The motors tell us each pwm as it is set, so the
+// raw samples have the learned offset for the pwm taken off (before they are
+// used or traced), and get_orientation() holds the heading through a glitch.
+//
+// The offsets are learned by a calibration routine, run from rotator_update()
+// like the identification routine, and saved in EEPROM.
+
+#include <Arduino.h>
+
+// Axes to calibrate (bit mask)
+const byte magcal_axis_az = 0x01 ;
+const byte magcal_axis_el = 0x02 ;
+
+// Offsets are learned at this many pwm steps each way, and interpolated between
+const byte magcal_steps = 4 ;
+const int magcal_step_pwm = 64 ;
+
+// Result of the last calibration, see magcal_result()
+const byte magcal_result_none = 0 ;        // not run since reset
+const byte magcal_result_running = 1 ;
+const byte magcal_result_done = 2 ;
+const byte magcal_result_aborted = 3 ;
+const byte magcal_result_saturated = 4 ;   // done, but some offsets were too big for the table
+const byte magcal_result_moved = 5 ;       // the axis kept moving with the pulses
+const byte magcal_result_no_deadband = 6 ; // the axis deadband (min pwm) isn't known
+
+void magcal_setup();
+void magcal_motor_pwm(byte axis, int pwm);
+void magcal_compensate(int16_t mag[3]);
+bool magcal_blanking();
+long magcal_transient_msecs();
+void magcal_set_state(int az_pwm, int el_pwm, long transient_msecs);
+void magcal_start(byte axes, long cur_msecs);
+void magcal_abort();
+bool magcal_running();
+byte magcal_result();
+const __FlashStringHelper * magcal_result_name(byte result);
+void magcal_update(long cur_msecs, const int16_t accel[3], const int16_t mag[3], int * az_pwm, int * el_pwm);
+void magcal_offset(byte axis, int pwm, int16_t offset[3]);
+void magcal_save();
+void magcal_clear();
@@ -10,6 +10,10 @@
 #include "config.h"
 #include "rotator.h"
 #include "serial.h"
+#include "trace.h"
+#include "power.h"
+#include "track.h"
+#include "debuglog.h"
 
 void setup()
 {
@@ -21,6 +25,18 @@ void setup()
 
   // clear serial buffers
   serial_data_clear();
+
+  // multi-drop protocol address and RS-485 bus
+  serial_multidrop_setup();
+
+  // start any trace recording
+  trace_set_decimation(trace_startup_decimation);
+
+  // idle sleep and duty cycle measurement
+  power_setup();
+
+  // saved site for sun/moon tracking
+  track_setup();
 }
 
 
@@ -34,4 +50,19 @@ void loop(void)
   {
     serial_data_handler();
   }
+
+  // Send any multi-drop protocol responses due
+  serial_multidrop_update();
+
+  // Follow the sun/moon if tracking
+  track_update();
+
+  // Send any trace snapshot parts there is room for
+  trace_send_snapshot();
+
+  // Send any debug log events there is room for
+  debuglog_drain();
+
+  // While the rotator is idle sleep until the next interrupt (timer or serial rx)
+  power_update(rotator_idle() && Serial.available() == 0 && ! serial_multidrop_busy());
 }
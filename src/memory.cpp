@@ -0,0 +1,58 @@
+// Functions related to RAM usage diagnostics
+// rototor_areg
+// VK5CD
+//
+// All RAM from the end of our static variables (.data/.bss) to the top of
+// the stack is painted with a canary value at reset, before any of our code
+// runs. The stack grows down into this area, so the untouched canary bytes
+// remaining give the stack high-water mark, i.e. the minimum free RAM seen.
+//
+// Nothing in the rotator uses malloc (e.g. no Arduino String), so the area
+// above .bss is only ever used by the stack.
+
+#include "memory.h"
+
+// Linker provided symbols
+extern uint8_t _end;      // end of .bss
+extern uint8_t __stack;   // top of RAM, where the stack starts
+
+const uint8_t stack_canary = 0xc5 ;
+
+// Paint RAM before the C runtime has set up the stack (or zeroed r1), so it
+// has to be done in assembly from the .init1 section
+void memory_paint_stack() __attribute__ ((naked, used, section (".init1")));
+void memory_paint_stack()
+{
+  __asm volatile ("    ldi r30, lo8(_end)\n"
+                  "    ldi r31, hi8(_end)\n"
+                  "    ldi r24, %0\n"
+                  "    ldi r25, hi8(__stack)\n"
+                  "    rjmp 2f\n"
+                  "1:  st Z+, r24\n"
+                  "2:  cpi r30, lo8(__stack)\n"
+                  "    cpc r31, r25\n"
+                  "    brlo 1b\n"
+                  "    breq 1b\n"
+                  :: "M" (stack_canary));
+}
+
+// Return the least free RAM there has ever been between .bss and the stack
+unsigned int memory_stack_free_min()
+{
+  const uint8_t * p = &_end ;
+  unsigned int count = 0 ;
+
+  while ( p <= &__stack && *p == stack_canary )
+  {
+    p ++ ;
+    count ++ ;
+  }
+  return count ;
+}
+
+// Return free RAM between .bss and the current stack pointer
+unsigned int memory_free_now()
+{
+  uint8_t top_of_free ; // is on the stack, so is our current stack position
+  return &top_of_free - &_end ;
+}
@@ -0,0 +1,9 @@
+// Functions related to RAM usage diagnostics
+// rototor_areg
+// VK5CD
+
+#include <Arduino.h>
+
+// Our functions
+unsigned int memory_stack_free_min();
+unsigned int memory_free_now();
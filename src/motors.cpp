@@ -6,6 +6,8 @@
 
 #include "config.h"
 #include "motors.h"
+#include "rotator.h"
+#include "magcal.h"
 
 bool last_dir_pitch_up;
 bool last_dir_clockwise;
@@ -42,6 +44,7 @@ void set_el_motor_pwm_speed(int pwm_speed)
     last_dir_pitch_up = dir_pitch_up ;
   }
   analogWrite( E1, abs(pwm_speed) ) ;
+  magcal_motor_pwm(rotator_axis_el, pwm_speed) ;
 }
 
 // Set speed of Azimuth motor
@@ -57,6 +60,7 @@ void set_az_motor_pwm_speed(int pwm_speed)
     last_dir_clockwise = dir_clockwise ;
   }
   analogWrite( E2, abs(pwm_speed) ) ;
+  magcal_motor_pwm(rotator_axis_az, pwm_speed) ;
 }
 
 // Set motor direction pin settings
@@ -0,0 +1,152 @@
+// Functions related to saving power while the rotator is idle
+// rototor_areg
+// VK5CD
+//
+// Once the rotator has been stopped for a while it goes idle (see
+// rotator_update()), only updating a few times a second with the sensors in
+// low power. In between the main loop puts the MCU in idle sleep, which keeps
+// the UART running so serial rx wakes it.
+//
+// Timer 0 runs at /8 for the motor pwm (see motors.cpp), so its overflow
+// interrupt (millis) would wake the MCU every 128 usecs. While asleep that
+// interrupt is off and timer 2 wakes the MCU instead, up to 16 msecs later,
+// then the overflows timer 0 made meanwhile are added to the core's millis()
+// and micros() counts, as its overflow interrupt would have.
+//
+// host/power/power_check.cpp checks this against a model of the timers.
+//
+// The time spent asleep is measured with the timers to give the duty cycle,
+// the fraction of time awake. Each sleep ends with the interrupt that wakes
+// the MCU (a few usecs, counted as asleep), so the time in any other interrupt
+// counts as awake.
+
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+
+#include "power.h"
+
+// The Arduino core's counts behind millis() and micros() (wiring.c), which
+// the timer 0 overflow interrupt adds to
+extern volatile unsigned long timer0_overflow_count ;
+extern volatile unsigned long timer0_millis ;
+
+// Each timer 0 overflow adds 1 + 3/125 to millis(), as in wiring.c
+const byte power_fract_inc = 3 ;
+const byte power_fract_max = 125 ;
+
+// Timer 2 at /1024 ticks once every 128 timer 0 (/8) counts, and wakes the
+// MCU after at most this many ticks (16.3 msecs)
+const byte power_counts_per_tick = 128 ;
+const byte power_max_sleep_ticks = 255 ;
+
+// micros() goes up 4 per timer 0 count, as it assumes timer 0 is at /64
+const byte power_micros_per_count = 4 ;
+
+// Duty cycle measurement, in micros() which like millis() runs fast but as
+// they are only used for a ratio that doesn't matter
+unsigned long power_window_start_usecs ;
+unsigned long power_slept_usecs ;
+byte power_millis_fract = 0 ;
+
+// Longest the window can get before micros() wrapping would be a problem
+const unsigned long power_max_window_usecs = 0x40000000UL ;
+
+// Only wakes the MCU
+EMPTY_INTERRUPT(TIMER2_COMPA_vect);
+
+void power_setup()
+{
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  power_window_start_usecs = micros();
+  power_slept_usecs = 0 ;
+}
+
+// Timer 0 count, but not 255 where it could overflow before the overflow
+// flag is read next (at /8 the next overflow is then at least 8 clocks off)
+byte power_timer0_count()
+{
+  byte count ;
+  do
+    count = TCNT0 ;
+  while ( count == 255 ) ;
+  return count ;
+}
+
+// Sleep until serial rx or another interrupt, or at most power_max_sleep_ticks
+// Returns how long it slept in micros()
+unsigned long power_sleep()
+{
+  // Timer 2 counts whole ticks from now, CTC so the compare match wakes us
+  TCCR2B = 0 ;
+  TCCR2A = _BV(WGM21) ;
+  TCNT2 = 0 ;
+  OCR2A = power_max_sleep_ticks ;
+  TIFR2 = _BV(OCF2A) ;
+  TIMSK2 = _BV(OCIE2A) ;
+
+  cli();
+  byte start_count = power_timer0_count() ;
+  bool pending = TIFR0 & _BV(TOV0) ; // overflowed before interrupts were off
+  GTCCR = _BV(PSRASY) ;
+  TCCR2B = _BV(CS22) | _BV(CS21) | _BV(CS20) ;
+  TIMSK0 &= ~_BV(TOIE0) ;
+  sleep_enable();
+  sei();
+  sleep_cpu();   // sei() lets one more instruction run first, so no wake is missed
+  sleep_disable();
+
+  cli();
+  byte end_count = power_timer0_count() ;
+  byte ticks = TCNT2 ;
+  TCCR2B = 0 ;
+  TIMSK2 = 0 ;
+
+  // Timer 2 gives the whole ticks slept, up to 128 counts short, and the
+  // timer 0 count gives the exact counts modulo 256
+  unsigned int counts = ticks * power_counts_per_tick ;
+  counts += byte(end_count - start_count - counts) ;
+
+  // Overflows while asleep and any pending before, all added here
+  unsigned int overflows = ( ( start_count + counts ) >> 8 ) + pending ;
+  TIFR0 = _BV(TOV0) ;
+
+  timer0_overflow_count += overflows ;
+  unsigned int fract = power_millis_fract + overflows * power_fract_inc ;
+  timer0_millis += overflows + fract / power_fract_max ;
+  power_millis_fract = fract % power_fract_max ;
+
+  TIMSK0 |= _BV(TOIE0) ;
+  sei();
+
+  return (unsigned long)counts * power_micros_per_count ;
+}
+
+// Called every main loop, sleeps until the next interrupt if allowed
+void power_update(bool can_sleep)
+{
+  if ( can_sleep )
+    power_slept_usecs += power_sleep() ;
+
+  // Halve the window when it gets long, keeping the ratio
+  unsigned long window_usecs = micros() - power_window_start_usecs ;
+  if ( window_usecs > power_max_window_usecs )
+  {
+    power_window_start_usecs += window_usecs / 2 ;
+    power_slept_usecs /= 2 ;
+  }
+}
+
+// Return the duty cycle (time awake) in 0.1% since last called, and start again
+unsigned int power_awake_permille()
+{
+  unsigned long now_usecs = micros();
+  unsigned long window_msecs = ( now_usecs - power_window_start_usecs ) / 1000 ;
+  unsigned int permille = 1000 ;
+
+  if ( window_msecs > 0 )
+    permille = 1000 - min(power_slept_usecs / window_msecs, 1000UL) ;
+
+  power_window_start_usecs = now_usecs ;
+  power_slept_usecs = 0 ;
+  return permille ;
+}
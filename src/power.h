@@ -0,0 +1,10 @@
+// Functions related to saving power while the rotator is idle
+// rototor_areg
+// VK5CD
+
+#include <Arduino.h>
+
+// Our functions
+void power_setup();
+void power_update(bool can_sleep);
+unsigned int power_awake_permille();
@@ -2,18 +2,52 @@
 // rototor_areg
 // VK5CD
 
+#include <Arduino.h>
+
 #include "config.h"
 #include "rotator.h"
 #include "ahrs.h"
 #include "motors.h"
+#include "trace.h"
+#include "tuning.h"
+#include "fault.h"
+#include "track.h"
+#include "magcal.h"
+#include "debuglog.h"
+
+// Our current and target orientations and values (0.1 degrees)
+ahrs_orientation cur_orientation, target_orientation;
+
+// Last pwm speed set for motors, in fixed point so ramping can change them by
+// fractions of a pwm step each iteration without using floats
+const int pwm_scale = 64 ; // 1/64th of a pwm step
+int az_motor_pwm_speed, el_motor_pwm_speed;
 
-// Our current and target orientations and values
-sensors_vec_t  cur_orientation, target_orientation;
-float az_motor_pwm_speed, el_motor_pwm_speed; // last pwm speed set for motors
+void rotator_trace_update(long cur_msecs);
+void rotator_check_faults(long cur_msecs, bool az_easing, bool el_easing);
+void emergency_stop_motors();
+void rotator_update_idle(long cur_msecs);
+
+// Per axis tuning, see rotator_set_tuning()
+rotator_axis_tuning az_tuning, el_tuning;
 
 // How much to change each motor speed when ramping p/ms
-const float az_ramp_per_msec = float(az_motor_max_pwm) / float(az_ramp_time_msecs) ;
-const float el_ramp_per_msec = float(el_motor_max_pwm) / float(el_ramp_time_msecs) ;
+// (in 1/256th of our fixed point pwm steps, so shift result right by 8)
+const byte ramp_shift = 8 ;
+long az_ramp_per_msec, el_ramp_per_msec;
+
+// Ramp being logged, so only its start and end are logged rather than every
+// step, which would soon overwrite everything else in the debug log ring
+bool az_ramping = false, el_ramping = false ;
+int az_ramp_wanted, el_ramp_wanted ;
+
+// Backlash compensation, see backlash_approach() and backlash_takeup()
+rotator_axis_backlash az_backlash, el_backlash;
+const int backlash_moved = 5 ; // travel that ends taking up the backlash, 0.1 degrees
+
+// Idle once stopped for idle_after_msecs, see rotator_update_idle()
+bool idle = false ;
+long idle_since_msecs ;
 
 // To disable any new movement from motors
 bool movement_disabled ;
@@ -25,9 +59,18 @@ long prev_msecs = millis() / millis_correction ;
 // Internal routine to set desired orientation
 void set_target(int azimuth, int elevation)
 {
+  // Stay stopped after a fault until it is cleared on purpose, see fault_clear()
+  if ( fault_code() != fault_none )
+    return ;
+
   // Only update a new target if we've exceeded our movement disabled start + lockout time
   if ( prev_msecs > movement_disabled_start_millis + movement_disabled_lockout_millis )
   {
+    // A new target takes over from any identification routine
+    tuning_abort();
+    magcal_abort();
+    rotator_wake();
+
     // Limit azimuth to +/- 180 degrees where 0 = north, 90 = east etc
     while (azimuth > 180 ) azimuth -= 360 ;
     while (azimuth < -180 ) azimuth += 360 ;
@@ -37,20 +80,108 @@ void set_target(int azimuth, int elevation)
     if (elevation < el_min_degrees) elevation = el_min_degrees ;
 
     // Now set our desired orientation
-    target_orientation.heading = azimuth;
-    target_orientation.pitch = elevation;
+    target_orientation.heading = azimuth * 10;
+    target_orientation.pitch = elevation * 10;
+    az_backlash.overshooting = false ;
+    el_backlash.overshooting = false ;
 
     // We've now had a target set, so allow motors to move
     movement_disabled = false ;
   }
 }
 
+// Motors don't move below the min pwm deadband, so skip straight over it
+int skip_deadband(int pwm_speed, int pwm_speed_wanted, int min_pwm)
+{
+  if ( abs(pwm_speed) >= min_pwm * pwm_scale )
+    return pwm_speed ;
+  if ( pwm_speed_wanted > 0 )
+    return min_pwm * pwm_scale ;
+  if ( pwm_speed_wanted < 0 )
+    return - min_pwm * pwm_scale ;
+  return 0 ;
+}
+
+// Way to drive an axis to get to its target, 1 = clockwise/pitch up, -1 = anti-clockwise/
+// pitch down, 0 = stop. With an approach set the target is always reached moving that way,
+// going far enough past it first to take up the backlash if it is the other way, so the axis
+// stops with the gears loaded the same way (and at the same edge of the tolerance) each time
+int8_t backlash_approach(int position, int target, int min_position, int max_position,
+                         const rotator_axis_tuning * tuning, rotator_axis_backlash * backlash)
+{
+  int tolerance = tuning->tolerance_degrees * 5 ;
+
+  if ( tuning->approach != 0 )
+  {
+    if ( ( position - target ) * tuning->approach > tolerance )
+      backlash->overshooting = true ;
+    if ( backlash->overshooting )
+    {
+      int past = target - tuning->approach * ( tolerance + tuning->backlash_degrees * 10 ) ;
+      past = constrain(past, min_position, max_position) ;
+      if ( ( position - past ) * tuning->approach > 0 )
+        return - tuning->approach ;
+      backlash->overshooting = false ;
+    }
+  }
+
+  if ( position - tolerance > target )
+    return -1 ;
+  if ( position + tolerance < target )
+    return 1 ;
+  return 0 ;
+}
+
+// After the drive reverses the gears take up the backlash before the axis moves, and at full
+// pwm it then jumps as they engage and overshoots. So hold the pwm to just under halfway
+// between min and max until the axis is seen to move the new way. Fault detection doesn't
+// count taking up as driven, so it gives up after a fault window for a jam to still be caught.
+int backlash_takeup(long cur_msecs, int pwm_speed_wanted, int position, bool wraps,
+                    const rotator_axis_tuning * tuning, rotator_axis_backlash * backlash)
+{
+  int8_t dir = pwm_speed_wanted > 0 ? 1 : -1 ;
+
+  if ( tuning->backlash_degrees == 0 || pwm_speed_wanted == 0 )
+    return pwm_speed_wanted ;
+
+  if ( dir != backlash->drive_dir )
+  {
+    backlash->drive_dir = dir ;
+    backlash->taking_up = true ;
+    backlash->takeup_from = position ;
+    backlash->takeup_msecs = cur_msecs ;
+  }
+  if ( backlash->taking_up && cur_msecs - backlash->takeup_msecs >= fault_window_msecs )
+    backlash->taking_up = false ;
+  if ( ! backlash->taking_up )
+    return pwm_speed_wanted ;
+
+  int moved = position - backlash->takeup_from ;
+  if ( wraps && moved > 1800 ) moved -= 3600 ;
+  if ( wraps && moved < -1800 ) moved += 3600 ;
+  moved *= dir ;
+  if ( moved < 0 )
+    backlash->takeup_from = position ; // still coasting the old way
+  else if ( moved >= backlash_moved )
+  {
+    backlash->taking_up = false ;
+    return pwm_speed_wanted ;
+  }
+
+  int limit = ( ( tuning->min_pwm + tuning->max_pwm ) / 2 - 1 ) * pwm_scale ;
+  return dir * min(abs(pwm_speed_wanted), limit) ;
+}
+
 // Initial config and setup
 void rotator_setup()
 {
   ahrs_setup();
   motors_setup();
 
+  // Saved tuning, or the defaults from config
+  tuning_setup();
+  magcal_setup();
+
   // Default to our current orientation and stopped
   get_orientation(&cur_orientation, true); // true = force initial value, ignoring errors
   target_orientation = cur_orientation;
@@ -66,158 +197,312 @@ void rotator_setup()
 //
 void rotator_update()
 {
-  float az_motor_pwm_speed_wanted = 0 ; // 0 = stopped, >0 clockwise, <0 anti-clockwise, max = abs(255)
-  float el_motor_pwm_speed_wanted = 0 ; // 0 = stopped, >0 clockwise, <0 anti-clockwise, max = abs(255)
-  float az_pwm_change ; // How much to change for this iteration
-  float el_pwm_change ; // How much to change for this iteration
+  int az_motor_pwm_speed_wanted = 0 ; // 0 = stopped, >0 clockwise, <0 anti-clockwise, max = abs(255 * pwm_scale)
+  int el_motor_pwm_speed_wanted = 0 ; // 0 = stopped, >0 clockwise, <0 anti-clockwise, max = abs(255 * pwm_scale)
+  long az_pwm_change ; // How much to change for this iteration
+  long el_pwm_change ; // How much to change for this iteration
   long cur_msecs = millis() / millis_correction ;
 
+  // When idle only update every so often, the main loop sleeps in between
+  if ( idle && cur_msecs - prev_msecs < idle_update_msecs )
+    return ;
+
   // Get our current orientation to work out what to do
   get_orientation(&cur_orientation);
-  #ifdef DEBUG_SERIAL
-    // Serial.println(cur_orientation.heading);
-  #endif
+
+  // Identification or magnetometer calibration routine has control of the motors while it runs
+  if ( tuning_running() || magcal_running() )
+  {
+    int az_pwm, el_pwm ;
+    if ( tuning_running() )
+      tuning_update(cur_msecs, cur_orientation.heading, cur_orientation.pitch, &az_pwm, &el_pwm);
+    else
+    {
+      ahrs_raw_values raw ;
+      ahrs_last_raw_values(&raw) ;
+      magcal_update(cur_msecs, raw.accel, raw.mag, &az_pwm, &el_pwm);
+    }
+    // The routines step the pwm, which isn't driving the axis until it stays put
+    bool az_easing = az_pwm * pwm_scale != az_motor_pwm_speed ;
+    bool el_easing = el_pwm * pwm_scale != el_motor_pwm_speed ;
+    az_motor_pwm_speed = az_pwm * pwm_scale ;
+    el_motor_pwm_speed = el_pwm * pwm_scale ;
+    az_ramping = el_ramping = false ;
+    set_az_motor_pwm_speed(az_pwm);
+    set_el_motor_pwm_speed(el_pwm);
+    // Leaves the gears loaded the way it last drove each axis
+    if ( az_pwm != 0 )
+      az_backlash.drive_dir = az_pwm > 0 ? 1 : -1 ;
+    if ( el_pwm != 0 )
+      el_backlash.drive_dir = el_pwm > 0 ? 1 : -1 ;
+    prev_msecs = cur_msecs ;
+    rotator_check_faults(cur_msecs, az_easing, el_easing);
+    rotator_update_idle(cur_msecs);
+    rotator_trace_update(cur_msecs);
+    return ;
+  }
 
   // ----------------------------------
   // Elevation calculations
   if ( ! movement_disabled )
   {
-    if (cur_orientation.pitch - (el_tolerance_degrees/2) > target_orientation.pitch)
-    {
-      el_motor_pwm_speed_wanted = - el_motor_max_pwm ; // pitch down
-    }
-    else if (cur_orientation.pitch + (el_tolerance_degrees/2) < target_orientation.pitch)
-    {
-      el_motor_pwm_speed_wanted = el_motor_max_pwm ; // pitch up
-    }
-    // else otherwise we want to stop (default is already 0)
+    // Pitch up, down, or otherwise we want to stop
+    el_motor_pwm_speed_wanted = backlash_approach(cur_orientation.pitch, target_orientation.pitch,
+                                                  el_min_degrees * 10, el_max_degrees * 10, &el_tuning, &el_backlash)
+                                * el_tuning.max_pwm * pwm_scale ;
+    el_motor_pwm_speed_wanted = backlash_takeup(cur_msecs, el_motor_pwm_speed_wanted, cur_orientation.pitch,
+                                                false, &el_tuning, &el_backlash);
   }
 
   // Adjust elevation motors if required
   if ( el_motor_pwm_speed_wanted != el_motor_pwm_speed )
   {
     // Calculate how much to change pwm speed by based on ramp times
-    if ( el_motor_pwm_speed_wanted > el_motor_pwm_speed )
-      el_pwm_change = ( cur_msecs - prev_msecs ) * az_ramp_per_msec ;
-    else
-      el_pwm_change = - ( cur_msecs - prev_msecs ) * az_ramp_per_msec ;
-    el_motor_pwm_speed += el_pwm_change ;
+    el_pwm_change = ( ( cur_msecs - prev_msecs ) * el_ramp_per_msec ) >> ramp_shift ;
+    if ( el_motor_pwm_speed_wanted < el_motor_pwm_speed )
+      el_pwm_change = - el_pwm_change ;
+
+    // Log a new ramp, or a change of speed wanted part way through one
+    if ( ! el_ramping || el_motor_pwm_speed_wanted != el_ramp_wanted )
+    {
+      debuglog_event(debuglog_el_ramp, el_motor_pwm_speed_wanted / pwm_scale, el_motor_pwm_speed / pwm_scale, el_pwm_change);
+      el_ramping = true ;
+      el_ramp_wanted = el_motor_pwm_speed_wanted ;
+    }
 
-    // If close enough to desired speed, then set it
-    if ( abs(el_motor_pwm_speed_wanted - el_motor_pwm_speed) < 5)
+    // If close enough to (or would go past) desired speed, then set it
+    if ( abs(el_motor_pwm_speed_wanted - el_motor_pwm_speed) < abs(el_pwm_change) + 5 * pwm_scale )
     {
       el_motor_pwm_speed = el_motor_pwm_speed_wanted ;
-      #ifdef DEBUG_SERIAL
-        Serial.println(F("EL RAMP: TARGET REACHED"));
-      #endif
+      el_ramping = false ;
+      debuglog_event(debuglog_el_ramp_done, el_motor_pwm_speed / pwm_scale, cur_orientation.pitch, target_orientation.pitch);
+    }
+    else
+    {
+      el_motor_pwm_speed += el_pwm_change ;
+      el_motor_pwm_speed = skip_deadband(el_motor_pwm_speed, el_motor_pwm_speed_wanted, el_tuning.min_pwm);
     }
-    #ifdef DEBUG_SERIAL
-      Serial.print(F("EL RAMP: "));
-      Serial.print(el_motor_pwm_speed_wanted);
-      Serial.print(F(" "));
-      Serial.print(el_motor_pwm_speed);
-      Serial.print(F(" "));
-      Serial.print(el_pwm_change);
-      Serial.println();
-    #endif
 
-    set_el_motor_pwm_speed(el_motor_pwm_speed);
+    set_el_motor_pwm_speed(el_motor_pwm_speed / pwm_scale);
   }
+  else
+    el_ramping = false ; // e.g. stopped by an emergency stop
 
   // ----------------------------------
   // Azimuth calculations
   if ( ! movement_disabled )
   {
-    if (cur_orientation.heading - (az_tolerance_degrees/2) > target_orientation.heading)
-    {
-      az_motor_pwm_speed_wanted = - az_motor_max_pwm ; // anti-clockwise
-    }
-    else if (cur_orientation.heading + (az_tolerance_degrees/2) < target_orientation.heading)
-    {
-      az_motor_pwm_speed_wanted = az_motor_max_pwm ; // clockwise
-    }
-    // else otherwise we want to stop (default is already 0)
+    // Clockwise, anti-clockwise, or otherwise we want to stop
+    az_motor_pwm_speed_wanted = backlash_approach(cur_orientation.heading, target_orientation.heading,
+                                                  - rotator_az_limit, rotator_az_limit, &az_tuning, &az_backlash)
+                                * az_tuning.max_pwm * pwm_scale ;
+    az_motor_pwm_speed_wanted = backlash_takeup(cur_msecs, az_motor_pwm_speed_wanted, cur_orientation.heading,
+                                                true, &az_tuning, &az_backlash);
   }
 
   // Adjust azimuth motors if required
   if ( az_motor_pwm_speed_wanted != az_motor_pwm_speed )
   {
     // Calculate how much to change pwm speed by based on ramp times
-    if ( az_motor_pwm_speed_wanted > az_motor_pwm_speed )
-      az_pwm_change = ( cur_msecs - prev_msecs ) * az_ramp_per_msec ;
-    else
-      az_pwm_change = - ( cur_msecs - prev_msecs ) * az_ramp_per_msec ;
-    az_motor_pwm_speed += az_pwm_change ;
+    az_pwm_change = ( ( cur_msecs - prev_msecs ) * az_ramp_per_msec ) >> ramp_shift ;
+    if ( az_motor_pwm_speed_wanted < az_motor_pwm_speed )
+      az_pwm_change = - az_pwm_change ;
 
-    // If close enough to desired speed, then set it
-    if ( abs(az_motor_pwm_speed_wanted - az_motor_pwm_speed) < 5)
+    // Log a new ramp, or a change of speed wanted part way through one
+    if ( ! az_ramping || az_motor_pwm_speed_wanted != az_ramp_wanted )
+    {
+      debuglog_event(debuglog_az_ramp, az_motor_pwm_speed_wanted / pwm_scale, az_motor_pwm_speed / pwm_scale, az_pwm_change);
+      az_ramping = true ;
+      az_ramp_wanted = az_motor_pwm_speed_wanted ;
+    }
+
+    // If close enough to (or would go past) desired speed, then set it
+    if ( abs(az_motor_pwm_speed_wanted - az_motor_pwm_speed) < abs(az_pwm_change) + 5 * pwm_scale )
     {
       az_motor_pwm_speed = az_motor_pwm_speed_wanted ;
-      #ifdef DEBUG_SERIAL
-        Serial.println(F("AZ RAMP: TARGET REACHED"));
-      #endif
+      az_ramping = false ;
+      debuglog_event(debuglog_az_ramp_done, az_motor_pwm_speed / pwm_scale, cur_orientation.heading, target_orientation.heading);
     }
-    #ifdef DEBUG_SERIAL
-      Serial.print(F("AZ RAMP: "));
-      Serial.print(cur_orientation.heading);
-      Serial.print(F(" "));
-      Serial.print(target_orientation.heading);
-      Serial.print(F(" "));
-      Serial.print(az_motor_pwm_speed_wanted);
-      Serial.print(F(" "));
-      Serial.print(az_motor_pwm_speed);
-      Serial.print(F(" "));
-      Serial.print(az_pwm_change);
-      Serial.println();
-    #endif
-
-    set_az_motor_pwm_speed(az_motor_pwm_speed);
+    else
+    {
+      az_motor_pwm_speed += az_pwm_change ;
+      az_motor_pwm_speed = skip_deadband(az_motor_pwm_speed, az_motor_pwm_speed_wanted, az_tuning.min_pwm);
+    }
+
+    set_az_motor_pwm_speed(az_motor_pwm_speed / pwm_scale);
   }
+  else
+    az_ramping = false ; // e.g. stopped by an emergency stop
 
   // Now update our prev_msecs for next iteration
   prev_msecs = cur_msecs ;
+
+  rotator_check_faults(cur_msecs, az_ramping || az_backlash.taking_up, el_ramping || el_backlash.taking_up);
+  rotator_update_idle(cur_msecs);
+  rotator_trace_update(cur_msecs);
+}
+
+// Go idle once the motors have been stopped for a while, and wake as soon as
+// either is driven again (e.g. pushed off target by the wind)
+void rotator_update_idle(long cur_msecs)
+{
+  if ( az_motor_pwm_speed != 0 || el_motor_pwm_speed != 0 || tuning_running() || magcal_running() )
+  {
+    idle_since_msecs = cur_msecs ;
+    rotator_wake();
+  }
+  else if ( ! idle && cur_msecs - idle_since_msecs >= idle_after_msecs )
+  {
+    idle = true ;
+    ahrs_set_low_power(true);
+  }
+}
+
+// Back to updating at full rate straight away
+void rotator_wake()
+{
+  idle_since_msecs = prev_msecs ;
+  if ( idle )
+  {
+    idle = false ;
+    ahrs_set_low_power(false);
+  }
+}
+
+// Time of the last rotator_update()
+long rotator_update_msecs()
+{
+  return prev_msecs ;
+}
+
+// True while idle, when the main loop can sleep between updates
+bool rotator_idle()
+{
+  return idle ;
+}
+
+// Check each axis is moving as its motor is driven, cutting the motors if not
+void rotator_check_faults(long cur_msecs, bool az_easing, bool el_easing)
+{
+  byte fault = fault_update(cur_msecs, cur_orientation.heading, cur_orientation.pitch,
+                            az_motor_pwm_speed / pwm_scale, el_motor_pwm_speed / pwm_scale,
+                            az_easing, el_easing);
+  if ( fault != fault_none )
+  {
+    emergency_stop_motors();
+    target_orientation = cur_orientation;
+    // Reported when asked ('f' cmd or multi-drop status), not sent unasked
+    debuglog_event(debuglog_fault, fault, cur_orientation.heading, cur_orientation.pitch);
+  }
+}
+
+// Record an iteration of rotator_update() if tracing
+void rotator_trace_update(long cur_msecs)
+{
+  if ( trace_tick() )
+  {
+    trace_update_record record ;
+    ahrs_raw_values raw ;
+    ahrs_last_raw_values(&raw) ;
+
+    record.msecs = cur_msecs ;
+    memcpy(record.accel, raw.accel, sizeof(record.accel)) ;
+    memcpy(record.mag, raw.mag, sizeof(record.mag)) ;
+    record.heading = cur_orientation.heading ;
+    record.pitch = cur_orientation.pitch ;
+    record.target_heading = target_orientation.heading ;
+    record.target_pitch = target_orientation.pitch ;
+    record.az_pwm = az_motor_pwm_speed / pwm_scale ;
+    record.el_pwm = el_motor_pwm_speed / pwm_scale ;
+    trace_send_update(&record) ;
+  }
+}
+
+// Record a command for trace replay, with the raw sample if it read the sensors
+void rotator_trace_command(char command, int azimuth, int elevation, bool read_sensors)
+{
+  trace_command_record record ;
+  ahrs_raw_values raw ;
+
+  if ( read_sensors )
+    ahrs_last_raw_values(&raw) ;
+  else
+    memset(&raw, 0, sizeof(raw)) ;
+
+  record.command = command ;
+  record.azimuth = azimuth ;
+  record.elevation = elevation ;
+  memcpy(record.accel, raw.accel, sizeof(record.accel)) ;
+  memcpy(record.mag, raw.mag, sizeof(record.mag)) ;
+  trace_send_command(&record) ;
 }
 
 // Used to set what we want the rotator to point to
 void rotator_target_orientation(int azimuth, int elevation)
 {
+  track_stop();
+  rotator_trace_command('t', azimuth, elevation, false);
   set_target(azimuth, elevation);
 }
 
 // Used to set what we want the rotator to point to
 void rotator_target_orientation(rotator_values target)
 {
+  track_stop();
+  rotator_trace_command('t', target.azimuth, target.elevation, false);
   set_target(target.azimuth, target.elevation);
 }
 
+// Target from sun/moon tracking, as above without stopping the tracking
+void rotator_track_orientation(int azimuth, int elevation)
+{
+  rotator_trace_command('t', azimuth, elevation, false);
+  set_target(azimuth, elevation);
+}
+
 // Return our current orientation
 void rotator_current_orientation(rotator_values * return_values)
 {
   // Current orientation is updated in main rotator_update function
   // so just return our current values
-  return_values->azimuth = cur_orientation.heading;
-  return_values->elevation = cur_orientation.pitch;
+  return_values->azimuth = cur_orientation.heading / 10;
+  return_values->elevation = cur_orientation.pitch / 10;
 }
 
 // Tell rotator to stop moving and ramp down motors as usual
 void rotator_stop_motors()
 {
+  track_stop();
+  tuning_abort();
+  magcal_abort();
   // Just set the target to our current orientation
   get_orientation(&cur_orientation);
+  rotator_trace_command('s', 0, 0, true);
   target_orientation = cur_orientation;
   // movement_disabled = true ; // Still allow targetting of current orientation, so don't disable
 }
 
-// Tell rototar to immediately stop motors and disable further movement
-void rotator_emergency_stop_motors()
+// Internal routine to immediately stop motors and disable further movement
+// (also used when a fault is detected, which replay reproduces so isn't traced)
+void emergency_stop_motors()
 {
+  tuning_abort();
+  magcal_abort();
   set_el_motor_pwm_speed(0);
   set_az_motor_pwm_speed(0);
   el_motor_pwm_speed = 0 ;
   az_motor_pwm_speed = 0 ;
   movement_disabled = true ;
   movement_disabled_start_millis = prev_msecs ; // start time of lockout
+}
+
+// Tell rototar to immediately stop motors and disable further movement
+void rotator_emergency_stop_motors()
+{
+  track_stop();
+  emergency_stop_motors();
   get_orientation(&cur_orientation);
+  rotator_trace_command('e', 0, 0, true);
   target_orientation = cur_orientation;
 }
 
@@ -225,5 +510,119 @@ void rotator_emergency_stop_motors()
 void rotator_home_orientation()
 {
   // Just set the target 0,0
+  track_stop();
+  rotator_trace_command('h', 0, 0, false);
   set_target(0,0);
 }
+
+// Run the identification routine on the given axes (see tuning.cpp)
+// Once finished the rotator stays put until given a new target
+// Returns false if refused as there is a fault, the routine drives the motors
+// with stall detection off so it must not drive into whatever caused it
+bool rotator_identify(byte axes)
+{
+  if ( fault_code() != fault_none )
+    return false ;
+
+  track_stop();
+  set_el_motor_pwm_speed(0);
+  set_az_motor_pwm_speed(0);
+  el_motor_pwm_speed = 0 ;
+  az_motor_pwm_speed = 0 ;
+  movement_disabled = true ;
+  target_orientation = cur_orientation;
+  rotator_trace_command('i', axes, 0, false);
+  rotator_wake();
+  magcal_abort();
+  tuning_start(axes, cur_orientation.heading, cur_orientation.pitch, prev_msecs);
+  return true ;
+}
+
+// Run the magnetometer calibration on the given axes (see magcal.cpp)
+// Returns false if refused as there is a fault, as for rotator_identify()
+bool rotator_magcal(byte axes)
+{
+  if ( fault_code() != fault_none )
+    return false ;
+
+  track_stop();
+  set_el_motor_pwm_speed(0);
+  set_az_motor_pwm_speed(0);
+  el_motor_pwm_speed = 0 ;
+  az_motor_pwm_speed = 0 ;
+  movement_disabled = true ;
+  target_orientation = cur_orientation;
+  rotator_trace_command('c', axes, 0, false);
+  rotator_wake();
+  tuning_abort();
+  magcal_start(axes, prev_msecs);
+  return true ;
+}
+
+// Get the tuning for one axis
+void rotator_get_tuning(byte axis, rotator_axis_tuning * tuning)
+{
+  *tuning = axis == rotator_axis_az ? az_tuning : el_tuning ;
+}
+
+// Change the tuning for one axis
+void rotator_set_tuning(byte axis, const rotator_axis_tuning * tuning)
+{
+  long ramp_per_msec = ( long(tuning->max_pwm) * pwm_scale << ramp_shift ) / tuning->ramp_time_msecs ;
+  if ( axis == rotator_axis_az )
+  {
+    az_tuning = *tuning ;
+    az_ramp_per_msec = ramp_per_msec ;
+  }
+  else
+  {
+    el_tuning = *tuning ;
+    el_ramp_per_msec = ramp_per_msec ;
+  }
+}
+
+// Save all internal state (used by trace recording)
+void rotator_save_state(rotator_state * state)
+{
+  state->prev_msecs = prev_msecs ;
+  state->cur_heading = cur_orientation.heading ;
+  state->cur_pitch = cur_orientation.pitch ;
+  state->target_heading = target_orientation.heading ;
+  state->target_pitch = target_orientation.pitch ;
+  state->az_motor_pwm_speed = az_motor_pwm_speed ;
+  state->el_motor_pwm_speed = el_motor_pwm_speed ;
+  state->movement_disabled = movement_disabled ;
+  state->movement_disabled_start_millis = movement_disabled_start_millis ;
+  state->heading_errors_count = ahrs_heading_errors() ;
+  state->idle = idle ;
+  state->idle_since_msecs = idle_since_msecs ;
+  state->az_backlash = az_backlash ;
+  state->el_backlash = el_backlash ;
+  state->mag_transient_msecs = magcal_transient_msecs() ;
+  state->az_fault_position = fault_update_position(rotator_axis_az) ;
+  state->el_fault_position = fault_update_position(rotator_axis_el) ;
+  state->az_fault_drive = fault_update_drive(rotator_axis_az) ;
+  state->el_fault_drive = fault_update_drive(rotator_axis_el) ;
+}
+
+// Restore all internal state (used by trace replay to start mid-run)
+void rotator_restore_state(const rotator_state * state)
+{
+  prev_msecs = state->prev_msecs ;
+  cur_orientation.heading = state->cur_heading ;
+  cur_orientation.pitch = state->cur_pitch ;
+  target_orientation.heading = state->target_heading ;
+  target_orientation.pitch = state->target_pitch ;
+  az_motor_pwm_speed = state->az_motor_pwm_speed ;
+  el_motor_pwm_speed = state->el_motor_pwm_speed ;
+  movement_disabled = state->movement_disabled ;
+  movement_disabled_start_millis = state->movement_disabled_start_millis ;
+  ahrs_set_heading_errors(state->heading_errors_count) ;
+  idle = state->idle ;
+  idle_since_msecs = state->idle_since_msecs ;
+  az_backlash = state->az_backlash ;
+  el_backlash = state->el_backlash ;
+  magcal_set_state(az_motor_pwm_speed / pwm_scale, el_motor_pwm_speed / pwm_scale, state->mag_transient_msecs) ;
+  fault_restore_update(rotator_axis_az, state->az_fault_position, state->az_fault_drive, cur_orientation.heading) ;
+  fault_restore_update(rotator_axis_el, state->el_fault_position, state->el_fault_drive, cur_orientation.pitch) ;
+}
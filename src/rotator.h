@@ -12,12 +12,79 @@ struct rotator_values
   int elevation;
 };
 
+// Per axis tuning of the motor control
+// Defaults are in config.h, and can be found with the identification routine
+struct rotator_axis_tuning
+{
+  int16_t tolerance_degrees; // stop moving once within half this of target
+  int16_t ramp_time_msecs;   // time to ramp motor from stopped to max pwm
+  int16_t max_pwm;
+  int16_t min_pwm;           // deadband, below this the axis doesn't move
+  int16_t backlash_degrees;  // play in the gears when the drive reverses, 0 = none
+  int8_t approach;           // always finish moving this way, 1 = clockwise/pitch up,
+                             // -1 = anti-clockwise/pitch down, 0 = either way
+} __attribute__((packed));
+
+// Per axis backlash compensation state, see rotator_update()
+struct rotator_axis_backlash
+{
+  int8_t drive_dir;      // way the axis was last driven, 1 = clockwise/pitch up
+  uint8_t taking_up;     // reversed and not seen to move the new way yet
+  int16_t takeup_from;   // furthest it got the old way, 0.1 degrees
+  int32_t takeup_msecs;  // when it reversed
+  uint8_t overshooting;  // going past the target to finish the approach way
+} __attribute__((packed));
+
+const byte rotator_axis_az = 0;
+const byte rotator_axis_el = 1;
+
+// Keep azimuth overshoots and tests clear of the wrap at +/-180, 0.1 degrees
+const int rotator_az_limit = 1790;
+
 // Our functions
 void rotator_setup();
 void rotator_update();
 void rotator_target_orientation(int azimuth, int elevation);
 void rotator_target_orientation(rotator_values target);
+void rotator_track_orientation(int azimuth, int elevation);
 void rotator_current_orientation(rotator_values * return_values);
 void rotator_stop_motors();
 void rotator_emergency_stop_motors();
 void rotator_home_orientation();
+bool rotator_identify(byte axes);
+bool rotator_magcal(byte axes);
+void rotator_wake();
+bool rotator_idle();
+long rotator_update_msecs();
+void rotator_get_tuning(byte axis, rotator_axis_tuning * tuning);
+void rotator_set_tuning(byte axis, const rotator_axis_tuning * tuning);
+
+// Snapshot of the internal rotator state, less the tuning and fault window
+// (see trace.h)
+// Used by trace recording so a host replay can start mid-run, hence packed
+// with fixed size types to be the same on the AVR and host
+struct rotator_state
+{
+  uint32_t prev_msecs;
+  int16_t cur_heading;
+  int16_t cur_pitch;
+  int16_t target_heading;
+  int16_t target_pitch;
+  int16_t az_motor_pwm_speed;
+  int16_t el_motor_pwm_speed;
+  uint8_t movement_disabled;
+  int32_t movement_disabled_start_millis;
+  uint8_t heading_errors_count;
+  uint8_t idle;
+  int32_t idle_since_msecs;
+  rotator_axis_backlash az_backlash;
+  rotator_axis_backlash el_backlash;
+  int32_t mag_transient_msecs;
+  int16_t az_fault_position;
+  int16_t el_fault_position;
+  uint8_t az_fault_drive;
+  uint8_t el_fault_drive;
+} __attribute__((packed));
+
+void rotator_save_state(rotator_state * state);
+void rotator_restore_state(const rotator_state * state);
@@ -2,15 +2,26 @@
 // rototor_areg
 // VK5CD
 
+#include <EEPROM.h>
+#include <util/crc16.h>
+
 #include "serial.h"
 #include "rotator.h"
 #include "config.h"
+#include "trace.h"
+#include "memory.h"
+#include "tuning.h"
+#include "fault.h"
+#include "power.h"
+#include "track.h"
+#include "ephemeris.h"
+#include "magcal.h"
+#include "debuglog.h"
 
 // Serial data buffer handling
 const int serial_buffer_size = 30;
 byte serial_buffer[serial_buffer_size];
 byte next_serial_index = serial_buffer_size ; // so inital clear zeros buffer
-bool serial_help_sent = false;
 
 // CLI constants
 const char cli_eol = byte('\n');
@@ -19,6 +30,56 @@ const char cli_eol = byte('\n');
 const char spid_eol = 0x20;                 //space
 const char spid_pulse_resolution = 0x01;    // report one pulse per degree resolution
 
+// Multi-drop binary protocol constants
+//
+// Frames are
+//   <sof> <address> <cmd> <payload length> <payload ...> <crc hi> <crc lo>
+// with a CRC-16/CCITT (0x1021, initial 0xFFFF) over address, cmd, length and
+// payload, and int16 values little endian.
+//
+// Commands are to one rotator's address, or to all with the broadcast address.
+// Each addressed cmd gets a response with the cmd | multidrop_response, from
+// the rotator's address, with a payload of
+//   <int16 azimuth> <int16 elevation> <status flags> <fault code>
+// Broadcasts get no response (they would collide), except a poll where each
+// rotator responds in its own time slot of address * multidrop_slot_msecs.
+//
+// Once an address has been saved the rotator is taken to be on a shared bus,
+// and ignores the CLI and SPID protocols, which every rotator would answer.
+// Setting address 0 forgets the saved address to get them back.
+const byte multidrop_sof = 0x7E;
+const byte multidrop_broadcast = 0xFF;
+const byte multidrop_response = 0x80;
+const byte multidrop_max_payload = 16;
+const byte multidrop_overhead = 6;          // sof, address, cmd, length + 2 byte crc
+
+// Multi-drop commands
+const byte multidrop_cmd_status = 0x01;        // just respond
+const byte multidrop_cmd_set_target = 0x02;    // <int16 az> <int16 el>
+const byte multidrop_cmd_stage_target = 0x03;  // <int16 az> <int16 el>, moves on go
+const byte multidrop_cmd_go = 0x04;            // move to staged target, broadcast to sync an array
+const byte multidrop_cmd_stop = 0x05;
+const byte multidrop_cmd_emergency_stop = 0x06; // broadcast to stop all
+const byte multidrop_cmd_home = 0x07;
+const byte multidrop_cmd_poll = 0x08;          // broadcast, responses in time slots
+const byte multidrop_cmd_clear_fault = 0x09;   // targets are refused until a fault is cleared
+const byte multidrop_cmd_set_address = 0x0A;   // <new address>, not broadcast, responds from the new address
+                                               // (0 forgets the saved address, responds from the default)
+
+// Multi-drop status flags
+const byte multidrop_status_staged = 0x01;     // staged target waiting for go
+const byte multidrop_status_fault = 0x02;      // motors stopped by a fault, see fault.h for the codes
+const byte multidrop_status_idle = 0x04;       // idle, in low power
+
+// Multi-drop state
+byte multidrop_address;
+bool multidrop_bus = false;                    // an address has been saved, see above
+bool multidrop_staged = false;
+int multidrop_staged_azimuth, multidrop_staged_elevation;
+bool multidrop_slot_pending = false;
+long multidrop_slot_msecs_due;
+bool multidrop_transmitting = false;
+
 // Simple serial data handler
 //
 // MUST NOT BLOCK AS WILL INTERFERE WITH MOTOR CONTROL!
@@ -53,8 +114,32 @@ void serial_data_handler()
     case 'E':
     case 'h': // Move to home orientation
     case 'H':
+    case 'r': // Trace recording
+    case 'R':
+    case 'm': // Memory usage
+    case 'M':
+    case 'a': // Multi-drop address
+    case 'A':
+    case 'i': // Identify/tune axes
+    case 'I':
+    case 'f': // Fault
+    case 'F':
+    case 'p': // Power
+    case 'P':
+    case 'k': // Sun/moon tracking
+    case 'K':
+    case 'c': // Magnetometer calibration
+    case 'C':
+    case 'l': // Debug log
+    case 'L':
     case '?': // Display help
     case cli_eol:
+      // Not on a multi-drop bus, as every rotator would answer
+      if ( multidrop_bus )
+      {
+        serial_data_clear();
+        break;
+      }
       // Do we have a complete line to process?
       if ( strchr( (char *)serial_buffer, cli_eol) )
       {
@@ -86,6 +171,51 @@ void serial_data_handler()
             // Move to home orientation 0,0
             serial_cli_cmd_home_orientation();
             break;
+          case 'r':
+          case 'R':
+            // Set trace recording decimation, e.g. 'r1' every update, 'r0' off
+            serial_cli_cmd_trace();
+            break;
+          case 'm':
+          case 'M':
+            // Report free RAM and stack high-water mark
+            serial_cli_cmd_memory();
+            break;
+          case 'a':
+          case 'A':
+            // Report multi-drop address
+            serial_cli_cmd_address();
+            break;
+          case 'i':
+          case 'I':
+            // Identify and tune axes, save or restore tuning, e.g. 'ia'
+            serial_cli_cmd_identify();
+            break;
+          case 'f':
+          case 'F':
+            // Report or clear any stall/obstruction fault, e.g. 'fc' clears
+            serial_cli_cmd_fault();
+            break;
+          case 'p':
+          case 'P':
+            // Report idle and duty cycle
+            serial_cli_cmd_power();
+            break;
+          case 'k':
+          case 'K':
+            // Sun/moon tracking, site and time, e.g. 'ks' tracks the sun
+            serial_cli_cmd_track();
+            break;
+          case 'c':
+          case 'C':
+            // Calibrate the magnetometer for the motor currents, e.g. 'ce'
+            serial_cli_cmd_magcal();
+            break;
+          case 'l':
+          case 'L':
+            // Debug log streaming, e.g. 'l1' on, 'l' sends what is logged
+            serial_cli_cmd_debuglog();
+            break;
           case '?':
           case cli_eol:
             // print help screen
@@ -100,6 +230,12 @@ void serial_data_handler()
     // Alphasid Rot2 protocol packet (always begins with 'W')
     //
     case 'W': // 0x57
+      // Not on a multi-drop bus, as every rotator would answer
+      if ( multidrop_bus )
+      {
+        serial_data_clear();
+        break;
+      }
       // Check have a 13 byte long command packet that terminates in spid_eol
       if ( next_serial_index > 12 )
       {
@@ -113,6 +249,26 @@ void serial_data_handler()
       }
       break;
 
+    // Multi-drop binary protocol frame (always begins with multidrop_sof)
+    //
+    case multidrop_sof:
+      // Need the header for the length, then wait for the complete frame
+      if ( next_serial_index > 3 )
+      {
+        if ( serial_buffer[3] > multidrop_max_payload )
+        {
+          // Can't be a valid frame
+          serial_data_clear();
+        }
+        else if ( next_serial_index >= serial_buffer[3] + multidrop_overhead )
+        {
+          serial_multidrop_parse_command();
+          // Cmd has been handled/ignored, clear out buffer
+          serial_data_clear();
+        }
+      }
+      break;
+
     // No one handled the 1st serial data byte, so throw it away
     //
     default:
@@ -144,17 +300,24 @@ void serial_cli_cmd_set_target()
   {
     // Should be 2 values comma separated
     * comma_ptr = 0 ; // terminate az string
-    azimuth = String((char *)serial_buffer + 1).toInt(); // +1 to jump over 't'
-    elevation = String(comma_ptr + 1).toInt(); // +1 to jump over ','
+    azimuth = atoi((char *)serial_buffer + 1); // +1 to jump over 't'
+    elevation = atoi(comma_ptr + 1); // +1 to jump over ','
   }
   else
   {
     // Single value, only set azimuth and elevation to 0
-    azimuth = String((char *)serial_buffer + 1).toInt(); // +1 to jump over 's'
+    azimuth = atoi((char *)serial_buffer + 1); // +1 to jump over 't'
   }
 
   // Now set the target
   rotator_target_orientation(azimuth, elevation);
+  if ( fault_code() != fault_none )
+  {
+    Serial.print(F("set_target: refused, fault: "));
+    Serial.print(fault_name(fault_code()));
+    Serial.println();
+    return;
+  }
 
   // Confirm setting back to serial CLI
   Serial.print(F("set_target: "));
@@ -202,6 +365,426 @@ void serial_cli_cmd_home_orientation()
   Serial.print(F("Move to Home orientation (0,0)\n"));
 }
 
+// Set binary trace recording decimation
+// format is [r|R][0..9]*, e.g. 'r1' records every rotator update, 'r0' or 'r' stops
+void serial_cli_cmd_trace()
+{
+  int decimation = atoi((char *)serial_buffer + 1); // +1 to jump over 'r'
+  if ( decimation < 0 ) decimation = 0 ;
+  if ( decimation > 255 ) decimation = 255 ;
+
+  trace_set_decimation(decimation);
+
+  Serial.print(F("trace: "));
+  Serial.print(decimation);
+  Serial.println();
+}
+
+// Debug log streaming
+// format is [l|L][0|1], 'l1' sends events as they are logged, 'l0' stops,
+// 'l' sends the events logged (up to debuglog_entries) once
+void serial_cli_cmd_debuglog()
+{
+  switch ( serial_buffer[1] )
+  {
+    case '0':
+    case '1':
+      debuglog_set_streaming(serial_buffer[1] == '1');
+      break;
+    default:
+      debuglog_dump();
+      break;
+  }
+
+  Serial.print(F("debuglog: "));
+  Serial.print(debuglog_get_streaming());
+  Serial.println();
+}
+
+// Outputs to serial the free RAM now, and the least there has ever been
+// (stack high-water mark) since reset
+//
+void serial_cli_cmd_memory()
+{
+  Serial.print(F("memory: free_now "));
+  Serial.print(memory_free_now());
+  Serial.print(F(" stack_free_min "));
+  Serial.print(memory_stack_free_min());
+  Serial.println();
+}
+
+// Report the multi-drop protocol address
+// Only reported, as on a shared bus every rotator would hear a CLI set. It is
+// set with the multi-drop set address cmd, which goes to the one rotator at
+// the current address
+void serial_cli_cmd_address()
+{
+  Serial.print(F("address: "));
+  Serial.print(multidrop_address);
+  Serial.println();
+}
+
+// Print one axis tuning and what was last measured
+void serial_cli_print_tuning(byte axis)
+{
+  rotator_axis_tuning tuning ;
+  tuning_axis_results results ;
+  rotator_get_tuning(axis, &tuning);
+  tuning_results(axis, &results);
+
+  Serial.print(axis == rotator_axis_az ? F("tuning: az") : F("tuning: el"));
+  Serial.print(F(" tolerance "));
+  Serial.print(tuning.tolerance_degrees);
+  Serial.print(F(" ramp "));
+  Serial.print(tuning.ramp_time_msecs);
+  Serial.print(F(" max_pwm "));
+  Serial.print(tuning.max_pwm);
+  Serial.print(F(" min_pwm "));
+  Serial.print(tuning.min_pwm);
+  Serial.print(F(" backlash "));
+  Serial.print(tuning.backlash_degrees);
+  Serial.print(F(" approach "));
+  Serial.print(tuning.approach);
+  Serial.print(F(" measured deadband "));
+  Serial.print(results.deadband_pwm);
+  Serial.print(F(" rate "));
+  Serial.print(results.max_rate);
+  Serial.print(F(" rise "));
+  Serial.print(results.rise_msecs);
+  Serial.print(F(" lag "));
+  Serial.print(results.lag_msecs);
+  Serial.print(F(" coast "));
+  Serial.print(results.coast);
+  Serial.println();
+}
+
+// Set the backlash compensation of one axis, e.g. 'ile2,1' for 2 degrees of
+// elevation backlash, always finishing pitching up
+void serial_cli_set_backlash()
+{
+  rotator_axis_tuning tuning ;
+  byte axis = serial_buffer[2] == 'e' ? rotator_axis_el : rotator_axis_az ;
+  char * comma_ptr = strchr((char *)serial_buffer, ',');
+  int backlash = atoi((char *)serial_buffer + 3); // +3 to jump over 'il' and the axis
+  int approach = comma_ptr ? atoi(comma_ptr + 1) : 0 ;
+
+  if ( ( serial_buffer[2] != 'a' && serial_buffer[2] != 'e' ) || backlash < 0 || backlash > 30 || approach < -1 || approach > 1 )
+  {
+    Serial.print(F("tuning: bad backlash\n"));
+    return ;
+  }
+  rotator_get_tuning(axis, &tuning);
+  tuning.backlash_degrees = backlash ;
+  tuning.approach = approach ;
+  rotator_set_tuning(axis, &tuning);
+  trace_resync(); // tuning is part of the replay state
+  serial_cli_print_tuning(axis);
+}
+
+// Report that a routine was refused as there is a fault
+void serial_cli_print_refused(const __FlashStringHelper * cmd)
+{
+  Serial.print(cmd);
+  Serial.print(F(": refused, fault: "));
+  Serial.print(fault_name(fault_code()));
+  Serial.println();
+}
+
+// Identify and tune the axes, or manage the tuning
+// format is [i|I][b|a|e|s|d|p], 'i' or 'ib' both axes, 'ia' azimuth, 'ie' elevation,
+// 'is' save tuning to EEPROM, 'id' restore defaults, 'ip' print how the last
+// identification ended and the tuning
+// or [i|I]l<a|e><backlash degrees>[,<approach -1|0|1>] to set an axis backlash compensation
+// Anything else is an error rather than moving the axes
+void serial_cli_cmd_identify()
+{
+  byte axes ;
+
+  switch (serial_buffer[1])
+  {
+    case 'l':
+      serial_cli_set_backlash();
+      return;
+    case 'a':
+      axes = tuning_axis_az ;
+      break;
+    case 'e':
+      axes = tuning_axis_el ;
+      break;
+    case 'b':
+    case cli_eol:
+    case '\r':
+      axes = tuning_axis_az | tuning_axis_el ;
+      break;
+    case 's':
+      tuning_save();
+      Serial.print(F("tuning: saved\n"));
+      return;
+    case 'd':
+      tuning_restore_defaults();
+      Serial.print(F("tuning: defaults\n"));
+      return;
+    case 'p':
+      Serial.print(F("identify: "));
+      Serial.print(tuning_result_name(tuning_result()));
+      Serial.println();
+      serial_cli_print_tuning(rotator_axis_az);
+      serial_cli_print_tuning(rotator_axis_el);
+      return;
+    default:
+      Serial.print(F("identify: unknown, see '?'\n"));
+      return;
+  }
+
+  if ( ! rotator_identify(axes) )
+  {
+    serial_cli_print_refused(F("identify"));
+    return;
+  }
+  Serial.print(F("identify:"));
+  if ( axes & tuning_axis_az )
+    Serial.print(F(" az"));
+  if ( axes & tuning_axis_el )
+    Serial.print(F(" el"));
+  Serial.println();
+}
+
+// Print the magnetometer offsets for one axis motor, at each pwm step forward then back
+void serial_cli_print_magcal(byte axis)
+{
+  int16_t offset[3] ;
+
+  Serial.print(axis == rotator_axis_az ? F("magcal: az") : F("magcal: el"));
+  for ( int pwm = - magcal_steps * magcal_step_pwm ; pwm <= magcal_steps * magcal_step_pwm ; pwm += magcal_step_pwm )
+  {
+    if ( pwm == 0 )
+      continue ;
+    magcal_offset(axis, pwm, offset);
+    Serial.print(F(" "));
+    Serial.print(constrain(pwm, -255, 255));
+    Serial.print(F(" "));
+    for ( byte i = 0 ; i < 3 ; i++ )
+    {
+      if ( i )
+        Serial.print(F(","));
+      Serial.print(offset[i]);
+    }
+  }
+  Serial.println();
+}
+
+// Calibrate the magnetometer for the motor currents, or manage the offsets
+// format is [c|C][b|a|e|s|d|p], 'c' or 'cb' both axes, 'ca' azimuth, 'ce' elevation,
+// 'cs' save offsets to EEPROM, 'cd' clear them, 'cp' print how the last
+// calibration ended and the offsets (0.1 uT at each pwm)
+// Anything else is an error rather than pulsing the motors
+void serial_cli_cmd_magcal()
+{
+  byte axes ;
+
+  switch (serial_buffer[1])
+  {
+    case 'a':
+      axes = magcal_axis_az ;
+      break;
+    case 'e':
+      axes = magcal_axis_el ;
+      break;
+    case 'b':
+    case cli_eol:
+    case '\r':
+      axes = magcal_axis_az | magcal_axis_el ;
+      break;
+    case 's':
+      magcal_save();
+      Serial.print(F("magcal: saved\n"));
+      return;
+    case 'd':
+      magcal_clear();
+      Serial.print(F("magcal: cleared\n"));
+      return;
+    case 'p':
+      Serial.print(F("magcal: "));
+      Serial.print(magcal_result_name(magcal_result()));
+      Serial.println();
+      serial_cli_print_magcal(rotator_axis_az);
+      serial_cli_print_magcal(rotator_axis_el);
+      return;
+    default:
+      Serial.print(F("magcal: unknown, see '?'\n"));
+      return;
+  }
+
+  if ( ! rotator_magcal(axes) )
+  {
+    serial_cli_print_refused(F("magcal"));
+    return;
+  }
+  Serial.print(F("magcal:"));
+  if ( axes & magcal_axis_az )
+    Serial.print(F(" az"));
+  if ( axes & magcal_axis_el )
+    Serial.print(F(" el"));
+  Serial.println();
+}
+
+// Report the fault code and name, or clear it first
+// format is [f|F][c]
+void serial_cli_cmd_fault()
+{
+  if ( serial_buffer[1] == 'c' )
+  {
+    fault_clear();
+    trace_resync(); // not a recorded command
+  }
+
+  Serial.print(F("fault: "));
+  Serial.print(fault_code());
+  Serial.print(F(" "));
+  Serial.print(fault_name(fault_code()));
+  Serial.println();
+}
+
+// Report if idle, and the duty cycle (time the MCU was awake, in 0.1%)
+// since the last report
+void serial_cli_cmd_power()
+{
+  Serial.print(F("power: idle "));
+  Serial.print(rotator_idle() ? 1 : 0);
+  Serial.print(F(" awake_permille "));
+  Serial.print(power_awake_permille());
+  Serial.println();
+}
+
+// Parse a decimal number, e.g. '-34.9285', into an integer with the given
+// number of decimal places, e.g. -34928 for 3. Returns where it stopped.
+char * serial_parse_decimal(char * text, byte places, long * value)
+{
+  bool negative = ( *text == '-' );
+  if ( negative )
+    text++ ;
+
+  *value = 0 ;
+  while ( *text >= '0' && *text <= '9' )
+    *value = *value * 10 + ( *text++ - '0' );
+  if ( *text == '.' )
+    text++ ;
+  for ( byte i = 0 ; i < places ; i++ )
+  {
+    *value *= 10 ;
+    if ( *text >= '0' && *text <= '9' )
+      *value += *text++ - '0' ;
+  }
+  // Ignore any more digits
+  while ( *text >= '0' && *text <= '9' )
+    text++ ;
+
+  if ( negative )
+    *value = - *value ;
+  return text ;
+}
+
+// Print the sun/moon tracking state, and where both are now
+void serial_cli_print_track()
+{
+  int azimuth, elevation ;
+  track_site site ;
+  unsigned long now = track_time();
+  bool site_valid = track_get_site(&site);
+
+  Serial.print(F("track: "));
+  Serial.print(track_body() == ephemeris_sun ? F("sun") : track_body() == ephemeris_moon ? F("moon") : F("off"));
+  Serial.print(F(" time "));
+  Serial.print(now);
+  if ( site_valid )
+  {
+    Serial.print(F(" site "));
+    Serial.print(site.latitude);
+    Serial.print(F(" "));
+    Serial.print(site.longitude);
+    Serial.print(F(" "));
+    Serial.print(site.declination);
+  }
+  if ( site_valid && now )
+  {
+    track_position(ephemeris_sun, &azimuth, &elevation);
+    Serial.print(F(" sun "));
+    Serial.print(azimuth);
+    Serial.print(F(" "));
+    Serial.print(elevation);
+    track_position(ephemeris_moon, &azimuth, &elevation);
+    Serial.print(F(" moon "));
+    Serial.print(azimuth);
+    Serial.print(F(" "));
+    Serial.print(elevation);
+  }
+  Serial.println();
+
+  if ( track_body() )
+  {
+    track_pass pass ;
+    track_get_pass(&pass);
+    Serial.print(F("pass: rise "));
+    Serial.print(pass.rise);
+    Serial.print(F(" "));
+    Serial.print(pass.rise_azimuth);
+    Serial.print(F(" set "));
+    Serial.print(pass.set);
+    Serial.print(F(" cross "));
+    Serial.print(pass.cross);
+    Serial.println();
+  }
+}
+
+// Sun/moon tracking
+// format is [k|K][s|m|x|u<unix time>|l<latitude>,<longitude>[,<declination>]]
+// 'ks' track the sun, 'km' the moon, 'kx' stop, 'ku1700000000' set the UTC time,
+// 'kl-34.929,138.601,8.2' set (and save) the site in degrees, 'k' reports
+void serial_cli_cmd_track()
+{
+  track_site site ;
+  long value ;
+  char * text = (char *)serial_buffer + 2 ; // +2 to jump over 'k' and the sub cmd
+
+  switch (serial_buffer[1])
+  {
+    case 's':
+    case 'm':
+      if ( ! track_start(serial_buffer[1] == 's' ? ephemeris_sun : ephemeris_moon) )
+      {
+        Serial.print(F("track: needs site and time\n"));
+        return ;
+      }
+      break;
+    case 'x':
+      track_stop();
+      break;
+    case 'u':
+      track_set_time(strtoul(text, NULL, 10));
+      break;
+    case 'l':
+      text = serial_parse_decimal(text, 3, &value);
+      site.latitude = value ;
+      if ( *text == ',' )
+        text = serial_parse_decimal(text + 1, 3, &value);
+      site.longitude = value ;
+      site.declination = 0 ;
+      if ( *text == ',' )
+      {
+        serial_parse_decimal(text + 1, 1, &value);
+        site.declination = value ;
+      }
+      if ( site.latitude < -90000L || site.latitude > 90000L || site.longitude < -180000L || site.longitude > 180000L )
+      {
+        Serial.print(F("track: bad site\n"));
+        return ;
+      }
+      track_set_site(&site);
+      break;
+  }
+  serial_cli_print_track();
+}
+
 // Help/banner info
 //
 void serial_cli_print_help(void)
@@ -214,6 +797,19 @@ void serial_cli_print_help(void)
   Serial.println(F("  h|H - move to Home orientation (0,0)"));
   Serial.println(F("  s|S - stop motors (nicely) by ramping down"));
   Serial.println(F("  e|E - EMERGENCY stop motors immediately"));
+  Serial.println(F("  r|R<n> - binary trace recording every n updates, 'r0' stops"));
+  Serial.println(F("  l|L[0|1] - binary debug log streaming on/off, 'l' sends the last events logged"));
+  Serial.println(F("  m|M - memory, returns free RAM now and least free since reset (stack high-water)"));
+  Serial.println(F("  a|A - report multi-drop protocol address (set with the multi-drop set address cmd)"));
+  Serial.println(F("  i|I[a|e] - identify and tune both axes (moves them!), or just az/el, stop with 's'"));
+  Serial.println(F("  i|I[s|d|p] - save tuning to EEPROM, restore default tuning, print result and tuning"));
+  Serial.println(F("  i|Il<a|e><degrees>[,<approach>] - set axis backlash, always finish clockwise/up 1, down -1"));
+  Serial.println(F("  c|C[a|e] - calibrate magnetometer for motor currents (pulses motors!), or just az/el"));
+  Serial.println(F("  c|C[s|d|p] - save magnetometer offsets to EEPROM, clear them, print result and offsets"));
+  Serial.println(F("  f|F[c] - report (or clear) stall/obstruction fault, e.g. 'fault: 1 az stall', targets, 'i' and 'c' refused until cleared"));
+  Serial.println(F("  p|P - power, returns if idle and time awake in 0.1% since last asked"));
+  Serial.println(F("  k|K[s|m|x] - track sun, moon, stop tracking, 'k' reports tracking and where both are"));
+  Serial.println(F("  k|K[u<utc>|l<lat>,<lon>[,<mag decl>]] - set UTC unix time, set site in degrees (saved)"));
   Serial.println(F("   ?  - Help"));
   Serial.println();
 }
@@ -329,3 +925,169 @@ int serial_spid_rot2_parse_direction( byte *buf, byte len, bool *err )
   //now calculate and return the result
   return (int)( u_dir / spid_pulse_resolution ) - 360;   //yes negative numbers are allowed
 }
+
+// ------------- Multi-drop protocol ----------------
+
+// Setup address and RS-485 direction control
+//
+void serial_multidrop_setup()
+{
+  multidrop_address = EEPROM.read(eeprom_multidrop_address);
+  if ( multidrop_address == 0 || multidrop_address == multidrop_broadcast ) // not saved yet
+    multidrop_address = multidrop_default_address ;
+  else
+    multidrop_bus = true ;
+
+  if ( rs485_direction_pin >= 0 )
+  {
+    digitalWrite(rs485_direction_pin, LOW); // receive
+    pinMode(rs485_direction_pin, OUTPUT);
+  }
+}
+
+// Send any slotted response when due, and release the RS-485 bus when
+// everything has been sent
+//
+// MUST NOT BLOCK AS WILL INTERFERE WITH MOTOR CONTROL!
+//
+void serial_multidrop_update()
+{
+  if ( multidrop_slot_pending &&
+       (long)( millis() / millis_correction - multidrop_slot_msecs_due ) >= 0 )
+  {
+    multidrop_slot_pending = false ;
+    serial_multidrop_send_response(multidrop_cmd_poll);
+  }
+
+  if ( multidrop_transmitting &&
+       Serial.availableForWrite() == SERIAL_TX_BUFFER_SIZE - 1 &&
+       ( UCSR0A & _BV(TXC0) ) )
+  {
+    multidrop_transmitting = false ;
+    if ( rs485_direction_pin >= 0 )
+      digitalWrite(rs485_direction_pin, LOW); // receive
+  }
+}
+
+// True while a slotted response is due or the RS-485 bus is still ours,
+// which serial_multidrop_update() has to see to on time so can't sleep
+bool serial_multidrop_busy()
+{
+  return multidrop_slot_pending || multidrop_transmitting ;
+}
+
+// Multi-drop protocol parsing, serial_buffer has a complete frame
+//
+void serial_multidrop_parse_command()
+{
+  byte address = serial_buffer[1];
+  byte cmd = serial_buffer[2];
+  byte len = serial_buffer[3];
+  byte * payload = &serial_buffer[4];
+  bool broadcast = address == multidrop_broadcast ;
+
+  // Ignore if not for us, or is a response from another rotator
+  if ( ( address != multidrop_address && ! broadcast ) || ( cmd & multidrop_response ) )
+    return;
+
+  uint16_t crc = 0xFFFF ;
+  for ( byte i = 1 ; i < 4 + len ; i++ )
+    crc = _crc_xmodem_update(crc, serial_buffer[i]);
+  if ( crc != ( ( serial_buffer[4 + len] << 8 ) | serial_buffer[5 + len] ) )
+    return;
+
+  switch (cmd)
+  {
+    case multidrop_cmd_status:
+      break;
+    case multidrop_cmd_set_target:
+    case multidrop_cmd_stage_target:
+      if ( len != 4 )
+        return;
+      multidrop_staged_azimuth = (int16_t)( payload[0] | ( payload[1] << 8 ) );
+      multidrop_staged_elevation = (int16_t)( payload[2] | ( payload[3] << 8 ) );
+      multidrop_staged = true ;
+      if ( cmd == multidrop_cmd_stage_target )
+        break;
+      // set target now, the same as go
+      // fall through
+    case multidrop_cmd_go:
+      if ( multidrop_staged )
+      {
+        rotator_target_orientation(multidrop_staged_azimuth, multidrop_staged_elevation);
+        multidrop_staged = false ;
+      }
+      break;
+    case multidrop_cmd_stop:
+      rotator_stop_motors();
+      break;
+    case multidrop_cmd_emergency_stop:
+      rotator_emergency_stop_motors();
+      break;
+    case multidrop_cmd_home:
+      rotator_home_orientation();
+      break;
+    case multidrop_cmd_clear_fault:
+      fault_clear();
+      trace_resync(); // not a recorded command
+      break;
+    case multidrop_cmd_set_address:
+      // Never broadcast, every rotator would take the same address
+      if ( broadcast || len != 1 || payload[0] == multidrop_broadcast )
+        return;
+      multidrop_bus = payload[0] != 0 ;
+      multidrop_address = multidrop_bus ? payload[0] : multidrop_default_address ;
+      EEPROM.update(eeprom_multidrop_address, multidrop_bus ? multidrop_address : multidrop_broadcast);
+      break;
+    case multidrop_cmd_poll:
+      if ( broadcast )
+      {
+        // Respond in our own slot so rotators don't talk over each other
+        multidrop_slot_msecs_due = millis() / millis_correction + (long)multidrop_address * multidrop_slot_msecs ;
+        multidrop_slot_pending = true ;
+        return;
+      }
+      break;
+    default:
+      return; // unknown, ignore
+  }
+
+  if ( ! broadcast )
+    serial_multidrop_send_response(cmd);
+}
+
+// Send a response with our current orientation and status
+//
+void serial_multidrop_send_response(byte cmd)
+{
+  rotator_values cur_orientation ;
+  rotator_current_orientation(&cur_orientation);
+
+  byte buf[multidrop_overhead + 6];
+  buf[0] = multidrop_sof;
+  buf[1] = multidrop_address;
+  buf[2] = cmd | multidrop_response;
+  buf[3] = 6;
+  buf[4] = cur_orientation.azimuth & 0xFF;
+  buf[5] = cur_orientation.azimuth >> 8;
+  buf[6] = cur_orientation.elevation & 0xFF;
+  buf[7] = cur_orientation.elevation >> 8;
+  buf[8] = multidrop_staged ? multidrop_status_staged : 0;
+  if ( fault_code() != fault_none )
+    buf[8] |= multidrop_status_fault;
+  if ( rotator_idle() )
+    buf[8] |= multidrop_status_idle;
+  buf[9] = fault_code();
+
+  uint16_t crc = 0xFFFF ;
+  for ( byte i = 1 ; i < 10 ; i++ )
+    crc = _crc_xmodem_update(crc, buf[i]);
+  buf[10] = crc >> 8;
+  buf[11] = crc & 0xFF;
+
+  // Take the RS-485 bus, serial_multidrop_update() releases it once sent
+  if ( rs485_direction_pin >= 0 )
+    digitalWrite(rs485_direction_pin, HIGH);
+  multidrop_transmitting = true ;
+  Serial.write(buf, sizeof(buf));
+}
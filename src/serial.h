@@ -17,9 +17,31 @@ void serial_cli_cmd_get_orientation();
 void serial_cli_cmd_stop_motors();
 void serial_cli_cmd_emergency_stop_motors();
 void serial_cli_cmd_home_orientation();
+void serial_cli_cmd_trace();
+void serial_cli_cmd_debuglog();
+void serial_cli_cmd_memory();
+void serial_cli_cmd_address();
+void serial_cli_print_refused(const __FlashStringHelper * cmd);
+void serial_cli_cmd_identify();
+void serial_cli_print_tuning(byte axis);
+void serial_cli_set_backlash();
+void serial_cli_print_magcal(byte axis);
+void serial_cli_cmd_magcal();
+void serial_cli_cmd_fault();
+void serial_cli_cmd_power();
+void serial_cli_cmd_track();
+void serial_cli_print_track();
+char * serial_parse_decimal(char * text, byte places, long * value);
 void serial_cli_print_help();
 
 // SPID ROT2 prototocl
 void serial_spid_rot2_parse_command();
 void serial_spid_rot2_send_response();
 int serial_spid_rot2_parse_direction( byte *buf, byte len,  bool *err );
+
+// Multi-drop binary protocol
+void serial_multidrop_setup();
+void serial_multidrop_update();
+bool serial_multidrop_busy();
+void serial_multidrop_parse_command();
+void serial_multidrop_send_response(byte cmd);
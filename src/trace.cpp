@@ -0,0 +1,241 @@
+// Functions related to binary trace recording of sensor and control values
+// rototor_areg
+// VK5CD
+
+#include <Arduino.h>
+
+#include "trace.h"
+#include "rotator.h"
+#include "fault.h"
+#include "tuning.h"
+#include "magcal.h"
+
+// Trace settings, 0 = off
+byte trace_decimation = 0 ;
+byte trace_decimation_count = 0 ;
+uint16_t trace_tick_count = 0 ;
+
+// Snapshot parts, in the order they are sent (see trace.h)
+const byte trace_part_tuning = 0 ;
+const byte trace_part_fault = 1 ;
+const byte trace_part_state = 2 ;
+const byte trace_parts = 3 ;
+
+// Next snapshot part to send, trace_parts once replay has all it needs
+// Started again by trace_resync()
+byte trace_snapshot_part = trace_parts ;
+// fault_window_version() as the fault part was sent, it is sent again if the
+// window moved on before the state part is out
+byte trace_fault_version = 0 ;
+
+struct trace_tuning_record
+{
+  uint16_t tick ;
+  rotator_axis_tuning az_tuning ;
+  rotator_axis_tuning el_tuning ;
+} __attribute__((packed)) ;
+
+struct trace_fault_record
+{
+  uint16_t tick ;
+  fault_window_state window ;
+} __attribute__((packed)) ;
+
+struct trace_state_record
+{
+  uint16_t tick ;
+  rotator_state state ;
+} __attribute__((packed)) ;
+
+// Each part has to fit in the serial tx buffer on its own
+static_assert(sizeof(trace_tuning_record) + trace_frame_overhead < SERIAL_TX_BUFFER_SIZE, "tuning snapshot part too big") ;
+static_assert(sizeof(trace_fault_record) + trace_frame_overhead < SERIAL_TX_BUFFER_SIZE, "fault snapshot part too big") ;
+static_assert(sizeof(trace_state_record) + trace_frame_overhead < SERIAL_TX_BUFFER_SIZE, "state snapshot part too big") ;
+
+// Change how often update records are sent, 0 = off
+void trace_set_decimation(byte decimation)
+{
+  trace_decimation = decimation ;
+  trace_decimation_count = 0 ;
+  trace_resync() ; // any replay has to start from a snapshot
+}
+
+byte trace_get_decimation()
+{
+  return trace_decimation ;
+}
+
+// Send a state snapshot at the next opportunity, for when the rotator state
+// is changed other than by a recorded command
+void trace_resync()
+{
+  trace_snapshot_part = trace_part_tuning ;
+}
+
+// No snapshot needed, for replay which starts from the one it was sent
+void trace_set_synced()
+{
+  trace_snapshot_part = trace_parts ;
+}
+
+// Called once per rotator_update()
+// Returns true if an update record should be sent for this iteration
+bool trace_tick()
+{
+  if ( trace_decimation == 0 )
+    return false ;
+
+  trace_tick_count ++ ;
+  if ( ++trace_decimation_count < trace_decimation )
+    return false ;
+
+  trace_decimation_count = 0 ;
+  return true ;
+}
+
+// Whether there is room to send a record with this payload length now
+// In r1 there always is, as replay needs every update and command, so sending
+// holds the loop until the serial tx buffer has room (as Serial.write() does).
+// The time used is in each update record, so replay is still exact
+bool trace_has_room(byte len)
+{
+  return trace_decimation == 1 || Serial.availableForWrite() >= int(len + trace_frame_overhead) ;
+}
+
+// Send one framed record
+//
+// MUST NOT BLOCK, so the caller checks there is room in the serial tx buffer
+// (see trace_has_room())
+//
+void trace_send_record(byte type, const byte * payload, byte len)
+{
+  byte check_a = 0, check_b = 0 ;
+  byte header[4] = { trace_sync_1, trace_sync_2, type, len } ;
+
+  // Fletcher-16 over type, length and payload
+  for ( byte i = 2 ; i < 4 + len ; i++ )
+  {
+    byte value = i < 4 ? header[i] : payload[i - 4] ;
+    check_a += value ;
+    if ( check_a < value ) check_a ++ ; // mod 255 via end around carry
+    if ( check_a == 255 ) check_a = 0 ;
+    check_b += check_a ;
+    if ( check_b < check_a ) check_b ++ ;
+    if ( check_b == 255 ) check_b = 0 ;
+  }
+
+  Serial.write(header, 4) ;
+  Serial.write(payload, len) ;
+  Serial.write(check_a) ;
+  Serial.write(check_b) ;
+}
+
+// Room the next record to send needs in the serial tx buffer, framing included,
+// 0 if not tracing
+int trace_next_record_size()
+{
+  if ( trace_decimation == 0 )
+    return 0 ;
+  if ( trace_snapshot_part == trace_part_tuning )
+    return sizeof(trace_tuning_record) + trace_frame_overhead ;
+  if ( trace_snapshot_part == trace_part_fault )
+    return sizeof(trace_fault_record) + trace_frame_overhead ;
+  if ( trace_snapshot_part < trace_parts )
+    return sizeof(trace_state_record) + trace_frame_overhead ;
+  return sizeof(trace_update_record) + trace_frame_overhead ;
+}
+
+// Send the next snapshot part, if there is room for it
+// Returns true if it was sent
+bool trace_send_snapshot_part()
+{
+  // The identification and magnetometer calibration routines' own state
+  // isn't in a snapshot, so replay has to wait for them to finish
+  if ( tuning_running() || magcal_running() )
+  {
+    trace_snapshot_part = trace_part_tuning ;
+    return false ;
+  }
+  // The parts have to be of the same fault window
+  if ( trace_snapshot_part == trace_part_state && fault_window_version() != trace_fault_version )
+    trace_snapshot_part = trace_part_fault ;
+
+  if ( trace_snapshot_part == trace_part_tuning )
+  {
+    trace_tuning_record record ;
+    if ( Serial.availableForWrite() < int(sizeof(record) + trace_frame_overhead) )
+      return false ;
+    record.tick = trace_tick_count ;
+    rotator_get_tuning(rotator_axis_az, &record.az_tuning) ;
+    rotator_get_tuning(rotator_axis_el, &record.el_tuning) ;
+    trace_send_record(trace_type_tuning, (byte *)&record, sizeof(record)) ;
+  }
+  else if ( trace_snapshot_part == trace_part_fault )
+  {
+    trace_fault_record record ;
+    if ( Serial.availableForWrite() < int(sizeof(record) + trace_frame_overhead) )
+      return false ;
+    record.tick = trace_tick_count ;
+    fault_save_window(&record.window) ;
+    trace_fault_version = fault_window_version() ;
+    trace_send_record(trace_type_fault, (byte *)&record, sizeof(record)) ;
+  }
+  else
+  {
+    trace_state_record record ;
+    if ( Serial.availableForWrite() < int(sizeof(record) + trace_frame_overhead) )
+      return false ;
+    record.tick = trace_tick_count ;
+    rotator_save_state(&record.state) ;
+    trace_send_record(trace_type_state, (byte *)&record, sizeof(record)) ;
+  }
+  trace_snapshot_part ++ ;
+  return true ;
+}
+
+// Send the snapshot parts there is room for between updates, as the state
+// only changes in an update or a command (which is recorded before the part)
+// When idle this gets the whole snapshot out before the next update
+//
+// MUST NOT BLOCK
+//
+void trace_send_snapshot()
+{
+  if ( trace_decimation == 0 )
+    return ;
+
+  while ( trace_snapshot_part < trace_parts && trace_send_snapshot_part() )
+    ;
+}
+
+// Send an update record, or drop it if the serial port can't keep up (only
+// above r1, where the trace is for plotting and can't be replayed anyway)
+void trace_send_update(trace_update_record * record)
+{
+  // Replay can't use update records until it has a whole snapshot
+  if ( trace_snapshot_part < trace_parts )
+  {
+    trace_send_snapshot() ;
+    return ;
+  }
+
+  if ( ! trace_has_room(sizeof(trace_update_record)) )
+    return ;
+
+  record->tick = trace_tick_count ;
+  trace_send_record(trace_type_update, (byte *)record, sizeof(trace_update_record)) ;
+}
+
+// Send a command record, these are never decimated (but can be dropped like
+// an update above r1)
+void trace_send_command(trace_command_record * record)
+{
+  if ( trace_decimation == 0 )
+    return ;
+
+  if ( ! trace_has_room(sizeof(trace_command_record)) )
+    return ;
+
+  record->tick = trace_tick_count ;
+  trace_send_record(trace_type_command, (byte *)record, sizeof(trace_command_record)) ;
+}
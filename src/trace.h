@@ -0,0 +1,88 @@
+// Functions related to binary trace recording of sensor and control values
+// rototor_areg
+// VK5CD
+//
+// Trace records are streamed out the serial port, interleaved with any CLI
+// text, so that a host can capture a run (python/trace_capture.py) and
+// replay it through the unmodified control code (host/replay/)
+//
+// Each record is framed as
+//   0xA5 0x5A <type> <payload length> <payload ...> <check A> <check B>
+// where check A/B are a Fletcher-16 checksum of type, length and payload.
+// All multi byte values are little endian, as on both the AVR and x86 host.
+//
+// Replay starts from a state snapshot, sent when recording starts and
+// whenever the state is changed other than by a recorded command (e.g. the
+// tuning saved or restored, or a fault cleared). It is too big to send at
+// once, so it is sent in parts: the tuning, the fault detection window, then
+// the rest of the rotator state. Each part is sent in place of an update
+// record once there is room for it in the serial tx buffer (63 bytes on the
+// Uno), or between updates (trace_send_snapshot()), and is of the state after
+// the last update. Update records are held until the last part is out, and
+// replay carries on from the update after it.
+//
+// With 'r1', for replay, the loop waits for room for each update and command
+// record, so none are dropped (the loop runs slower while recording, but each
+// update has its time in it). Decimated traces are only for plotting, so
+// records that don't fit are dropped rather than holding up the loop.
+//
+// The identification (tuning.cpp) and magnetometer calibration (magcal.cpp)
+// routines' state is not in a snapshot, so none is sent while either runs.
+// A trace that needs a snapshot during a routine can't be replayed again until
+// after it finishes.
+
+#include <Arduino.h>
+
+const byte trace_sync_1 = 0xA5 ;
+const byte trace_sync_2 = 0x5A ;
+
+// Record types
+const byte trace_type_update = 'U' ;  // one iteration of rotator_update()
+const byte trace_type_command = 'C' ; // rotator command from a serial protocol
+const byte trace_type_tuning = 'T' ;  // both axes tuning, first part of a snapshot
+const byte trace_type_fault = 'F' ;   // fault detection window, second part of a snapshot
+const byte trace_type_state = 'S' ;   // rotator state, last part of a snapshot
+const byte trace_type_log = 'L' ;     // debug log event (see debuglog.h), ignored by replay
+
+// Framing overhead of each record, 2 sync + type + length + 2 checksum
+const byte trace_frame_overhead = 6 ;
+
+// Update record, decimated by the trace setting
+struct trace_update_record
+{
+  uint16_t tick;             // rotator_update() count, gaps mean iterations not recorded
+  uint32_t msecs;            // time used for this iteration (millis corrected)
+  int16_t accel[3];          // raw accel, 0.01 m/s^2
+  int16_t mag[3];            // raw mag, 0.1 uT
+  int16_t heading;           // filtered heading, 0.1 degrees
+  int16_t pitch;             // pitch, 0.1 degrees
+  int16_t target_heading;    // 0.1 degrees
+  int16_t target_pitch;      // 0.1 degrees
+  int16_t az_pwm;            // commanded pwm, -255..255
+  int16_t el_pwm;            // commanded pwm, -255..255
+} __attribute__((packed));
+
+// Command record, always sent (never decimated)
+struct trace_command_record
+{
+  uint16_t tick;             // tick of last rotator_update()
+  char command;              // 't' target, 'h' home, 's' stop, 'e' emergency stop, 'i' identify,
+                             // 'c' magnetometer calibration
+  int16_t azimuth;           // target for 't', axes for 'i' and 'c'
+  int16_t elevation;
+  int16_t accel[3];          // raw sample read by 's' and 'e' commands
+  int16_t mag[3];
+} __attribute__((packed));
+
+// Trace decimation of 1 records every rotator_update(), which is needed for
+// an exact replay. Higher values are useful for plotting longer runs.
+void trace_set_decimation(byte decimation);
+byte trace_get_decimation();
+void trace_resync();
+void trace_set_synced();
+int trace_next_record_size();
+bool trace_tick();
+void trace_send_update(trace_update_record * record);
+void trace_send_snapshot();
+void trace_send_command(trace_command_record * record);
+void trace_send_record(byte type, const byte * payload, byte len);
@@ -0,0 +1,310 @@
+// Functions related to tracking the sun or moon on the rotator itself
+// rototor_areg
+// VK5CD
+//
+// The time is kept from millis() once set. Tracking works out the body's
+// position every track_update_msecs and only sets a new rotator target when
+// it moves a whole degree.
+//
+// Each pass is planned ahead, a step per update so as not to block, to find
+// where it rises, sets and crosses the azimuth wrap. The azimuth only turns
+// -180..180 (0 = north), so following a pass across south means turning all
+// the way round. If the part of the pass before (or after) the crossing is
+// shorter than that takes, it is skipped and the rotator waits at the edge of
+// the wrap on the side of the longer part instead.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "track.h"
+#include "ephemeris.h"
+#include "config.h"
+#include "rotator.h"
+#include "fault.h"
+
+// EEPROM marker for a saved site
+const byte track_eeprom_valid = 0x5A ;
+
+// Pass planning phases
+const byte track_plan_rise = 0 ;   // looking for the body to rise
+const byte track_plan_pass = 1 ;   // following the pass until it sets
+const byte track_plan_done = 2 ;
+
+// Edge of the azimuth wrap to wait at, 0.1 degrees
+const int track_wrap_edge = 1790 ;
+
+bool track_site_valid = false ;
+track_site track_saved_site ;
+ephemeris_site track_observer ;
+
+// Time, secs since J2000.0 (0 until set)
+long track_secs = 0 ;
+unsigned long track_clock_millis ;
+
+byte track_tracking = 0 ;          // ephemeris_sun/moon, 0 if not tracking
+unsigned long track_update_millis ;
+int track_target_azimuth, track_target_elevation ; // degrees, last set
+
+// Plan of the current or next pass, secs since J2000.0 (0 if not known)
+byte track_plan_phase ;
+long track_plan_at ;               // time of the last step
+int track_plan_azimuth ;           // magnetic azimuth at the last step
+int track_plan_elevation ;
+long track_rise_secs, track_set_secs, track_cross_secs ;
+int track_rise_azimuth ;
+int8_t track_cross_side ;          // sign of the azimuth after the crossing
+
+// Saved site, if there is one
+void track_setup()
+{
+  track_site site ;
+
+  if ( EEPROM.read(eeprom_track_site) != track_eeprom_valid )
+    return ;
+  EEPROM.get(eeprom_track_site + 1, site);
+  track_saved_site = site ;
+  ephemeris_set_site(site.latitude, site.longitude, &track_observer);
+  track_site_valid = true ;
+}
+
+// Set the site and save it in EEPROM
+void track_set_site(const track_site * site)
+{
+  track_saved_site = *site ;
+  ephemeris_set_site(site->latitude, site->longitude, &track_observer);
+  track_site_valid = true ;
+  EEPROM.put(eeprom_track_site + 1, track_saved_site);
+  EEPROM.update(eeprom_track_site, track_eeprom_valid);
+  if ( track_tracking )
+    track_start(track_tracking); // replan for the new site
+}
+
+bool track_get_site(track_site * site)
+{
+  *site = track_saved_site ;
+  return track_site_valid ;
+}
+
+// Set the UTC time, in secs since 1970 (unix time)
+void track_set_time(unsigned long unix_secs)
+{
+  track_secs = unix_secs - ephemeris_j2000_unix ;
+  track_clock_millis = millis();
+  if ( track_tracking )
+    track_start(track_tracking); // replan for the new time
+}
+
+// Keep the time going, whole secs at a time so millis() wrapping doesn't matter
+void track_clock_update()
+{
+  unsigned long ticks = millis() - track_clock_millis ;
+  const unsigned long ticks_per_sec = 1000UL * millis_correction ;
+
+  if ( ticks >= ticks_per_sec )
+  {
+    unsigned long secs = ticks / ticks_per_sec ;
+    track_secs += secs ;
+    track_clock_millis += secs * ticks_per_sec ;
+  }
+}
+
+// UTC unix time now, 0 if not set
+unsigned long track_time()
+{
+  if ( track_secs == 0 )
+    return 0 ;
+  track_clock_update();
+  return track_secs + ephemeris_j2000_unix ;
+}
+
+// True azimuth (0..3599) and elevation of the body now, 0.1 degrees
+void track_position(byte body, int * azimuth, int * elevation)
+{
+  track_clock_update();
+  ephemeris_position(body, track_secs, &track_observer, azimuth, elevation);
+}
+
+// Position of the tracked body as the rotator sees it, azimuth -1800..1800
+void track_magnetic_position(long secs, int * azimuth, int * elevation)
+{
+  ephemeris_position(track_tracking, secs, &track_observer, azimuth, elevation);
+  *azimuth -= track_saved_site.declination ;
+  if ( *azimuth > 1800 )
+    *azimuth -= 3600 ;
+  if ( *azimuth < -1800 )
+    *azimuth += 3600 ;
+}
+
+// Start planning from now
+void track_plan_start()
+{
+  int elevation ;
+
+  track_plan_at = track_secs ;
+  track_rise_secs = track_set_secs = track_cross_secs = 0 ;
+  track_magnetic_position(track_plan_at, &track_plan_azimuth, &elevation);
+  track_plan_elevation = elevation ;
+  if ( elevation >= 0 )
+  {
+    track_plan_phase = track_plan_pass ;
+    track_rise_secs = track_plan_at ;
+    track_rise_azimuth = track_plan_azimuth ;
+  }
+  else
+    track_plan_phase = track_plan_rise ;
+}
+
+// Time between the last planning step and this one that a value crossed 0,
+// by linear interpolation
+long track_plan_crossing(long before, long after)
+{
+  return track_plan_at - track_plan_step_secs + before * track_plan_step_secs / ( before - after ) ;
+}
+
+// Plan the next step ahead
+void track_plan_step()
+{
+  int azimuth, elevation ;
+
+  track_plan_at += track_plan_step_secs ;
+  track_magnetic_position(track_plan_at, &azimuth, &elevation);
+  if ( track_plan_phase == track_plan_rise )
+  {
+    if ( elevation >= 0 )
+    {
+      track_plan_phase = track_plan_pass ;
+      track_rise_secs = track_plan_crossing(track_plan_elevation, elevation) ;
+      track_rise_azimuth = azimuth ;
+    }
+  }
+  else if ( elevation < 0 )
+  {
+    track_plan_phase = track_plan_done ;
+    track_set_secs = track_plan_crossing(track_plan_elevation, elevation) ;
+  }
+  else if ( track_cross_secs == 0 && abs(azimuth - track_plan_azimuth) > 1800 )
+  {
+    // Distance from the wrap, negative once past it
+    track_cross_side = azimuth > 0 ? 1 : -1 ;
+    track_cross_secs = track_plan_crossing(1800 - abs(track_plan_azimuth), abs(azimuth) - 1800) ;
+  }
+  track_plan_azimuth = azimuth ;
+  track_plan_elevation = elevation ;
+
+  // Doesn't rise, or set, for a while
+  if ( track_plan_at - track_secs >= track_plan_secs )
+    track_plan_phase = track_plan_done ;
+}
+
+// Start tracking the body (ephemeris_sun/moon), needs the site and time
+bool track_start(byte body)
+{
+  if ( ! track_site_valid || track_secs == 0 )
+    return false ;
+  track_tracking = body ;
+  track_target_azimuth = track_target_elevation = 1000 ; // so the first target is always set
+  track_update_millis = millis() - track_update_msecs * (unsigned long)millis_correction ;
+  track_clock_update();
+  track_plan_start();
+  return true ;
+}
+
+// Stop tracking, leaving the rotator where it is going
+void track_stop()
+{
+  track_tracking = 0 ;
+}
+
+byte track_body()
+{
+  return track_tracking ;
+}
+
+// Plan of the current or next pass, as unix times
+void track_get_pass(track_pass * pass)
+{
+  pass->rise = track_rise_secs ? track_rise_secs + ephemeris_j2000_unix : 0 ;
+  pass->set = track_set_secs ? track_set_secs + ephemeris_j2000_unix : 0 ;
+  pass->cross = track_cross_secs ? track_cross_secs + ephemeris_j2000_unix : 0 ;
+  pass->rise_azimuth = track_rise_azimuth ;
+}
+
+// Where the rotator should point now, 0.1 degrees
+void track_target(int * azimuth, int * elevation)
+{
+  track_magnetic_position(track_secs, azimuth, elevation);
+
+  // Wait on the horizon where it will rise
+  if ( *elevation < 0 )
+  {
+    *elevation = 0 ;
+    if ( track_rise_secs > track_secs )
+      *azimuth = track_rise_azimuth ;
+  }
+
+  if ( track_cross_secs == 0 )
+    return ;
+
+  // Skip the shorter part of a pass either side of the wrap, if it is shorter
+  // than turning all the way round takes
+  long before = track_cross_secs - track_rise_secs ;
+  long after = ( track_set_secs ? track_set_secs : track_plan_at ) - track_cross_secs ;
+  // The crossing time is only as good as the interpolation, so near it go by
+  // which side the body is on
+  bool crossed = track_secs >= track_cross_secs + track_plan_step_secs ||
+                 ( track_secs >= track_cross_secs - track_plan_step_secs && ( *azimuth > 0 ) == ( track_cross_side > 0 ) ) ;
+
+  if ( ! crossed && before < track_unwind_secs && before <= after )
+    *azimuth = track_cross_side * track_wrap_edge ;
+  else if ( crossed && after < track_unwind_secs && after < before )
+    *azimuth = - track_cross_side * track_wrap_edge ;
+}
+
+// Follow the tracked body, called every loop
+//
+// MUST NOT BLOCK AS WILL INTERFERE WITH MOTOR CONTROL!
+//
+void track_update()
+{
+  int azimuth, elevation ;
+
+  if ( ! track_tracking )
+    return ;
+
+  // Don't keep driving into whatever stopped the rotator
+  if ( fault_code() != fault_none )
+  {
+    track_stop();
+    return ;
+  }
+
+  track_clock_update();
+
+  // Planning, one step each time round
+  if ( track_plan_phase != track_plan_done )
+  {
+    track_plan_step();
+    return ;
+  }
+
+  // Plan the next pass once this one has set (or the plan has run out)
+  if ( track_secs >= ( track_set_secs ? track_set_secs : track_plan_at ) )
+  {
+    track_plan_start();
+    return ;
+  }
+
+  if ( millis() - track_update_millis < track_update_msecs * (unsigned long)millis_correction )
+    return ;
+  track_update_millis = millis();
+
+  track_target(&azimuth, &elevation);
+  azimuth = ( azimuth + ( azimuth < 0 ? -5 : 5 ) ) / 10 ;
+  elevation = ( elevation + 5 ) / 10 ;
+  if ( azimuth != track_target_azimuth || elevation != track_target_elevation )
+  {
+    track_target_azimuth = azimuth ;
+    track_target_elevation = elevation ;
+    rotator_track_orientation(azimuth, elevation);
+  }
+}
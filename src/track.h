@@ -0,0 +1,38 @@
+// Functions related to tracking the sun or moon on the rotator itself
+// rototor_areg
+// VK5CD
+//
+// Given the site (saved in EEPROM) and the UTC time once, follows the body
+// through the normal rotator targets without any host traffic, waiting on the
+// horizon where it will next rise while it is down (see ephemeris.h)
+
+#include <Arduino.h>
+
+// Observer's site, as saved
+struct track_site
+{
+  int32_t latitude;    // 0.001 degrees, north positive
+  int32_t longitude;   // 0.001 degrees, east positive
+  int16_t declination; // magnetic, 0.1 degrees, east positive
+} __attribute__((packed));
+
+// Plan of the body's current or next pass, unix times, 0 if not known
+struct track_pass
+{
+  unsigned long rise;
+  unsigned long set;
+  unsigned long cross;  // crosses the azimuth wrap (south)
+  int rise_azimuth;     // magnetic, 0.1 degrees
+};
+
+void track_setup();
+void track_set_site(const track_site * site);
+bool track_get_site(track_site * site);
+void track_set_time(unsigned long unix_secs);
+unsigned long track_time();
+bool track_start(byte body);
+void track_stop();
+byte track_body();
+void track_position(byte body, int * azimuth, int * elevation);
+void track_get_pass(track_pass * pass);
+void track_update();
@@ -0,0 +1,418 @@
+// Functions related to identifying and tuning each axis of the rotator
+// rototor_areg
+// VK5CD
+//
+// For each axis, in one direction then back the other way, the routine
+//   - settles, then slowly raises the pwm until the axis moves (deadband)
+//   - settles, then steps to max pwm and measures the rate every window,
+//     giving the lag before it moves, rise time and steady max rate
+//   - sets the pwm to 0 and measures how far it coasts
+// then averages both directions and sets the tuning from them. Elevation
+// starts towards whichever limit has more room.
+//
+// It is a state machine run from rotator_update(), so like it
+// MUST NOT BLOCK AS WILL INTERFERE WITH SERIAL COMMANDS!
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "tuning.h"
+#include "config.h"
+#include "rotator.h"
+#include "trace.h"
+#include "debuglog.h"
+
+// Test settings
+const int tuning_settle_msecs = 1000 ;        // pwm 0 before each test
+const int tuning_deadband_step_msecs = 100 ;  // raise deadband pwm this often
+const int tuning_deadband_step_pwm = 2 ;
+const int tuning_moved = 15 ;                 // travel that counts as moving, 0.1 degrees
+const int tuning_first_movement = 5 ;         // travel that ends the lag, 0.1 degrees
+const int tuning_window_msecs = 200 ;         // rate measurement window
+const byte tuning_max_windows = 16 ;          // so max pwm step lasts up to 3.2 secs
+const int tuning_min_rate = 10 ;              // slower than this is stopped, 0.1 degrees/sec
+const int tuning_max_coast_msecs = 3000 ;
+const int tuning_min_ramp_msecs = 100 ;
+const int tuning_min_tolerance_degrees = 2 ;
+const int tuning_max_tolerance_degrees = 30 ;
+
+// EEPROM marker for saved tuning
+const byte tuning_eeprom_valid = 0x5B ; // changed with the rotator_axis_tuning layout
+
+// Test phases
+const byte tuning_phase_idle = 0 ;
+const byte tuning_phase_settle = 1 ;
+const byte tuning_phase_deadband = 2 ;
+const byte tuning_phase_step = 3 ;
+const byte tuning_phase_coast = 4 ;
+
+// Routine state
+byte tuning_phase = tuning_phase_idle ;
+byte tuning_next_phase ;           // phase to start once settled
+byte tuning_axes_todo ;            // tuning_axis_* bits still to do
+byte tuning_axis ;                 // rotator_axis_* being tested
+int8_t tuning_dir ;                // 1 = clockwise/pitch up, -1 = anti-clockwise/pitch down
+byte tuning_pass ;                 // 0 = first direction, 1 = back the other way
+int tuning_heading, tuning_pitch ; // last position seen, 0.1 degrees
+long tuning_phase_start_msecs ;
+long tuning_travel ;               // since start of phase, in tuning_dir, 0.1 degrees
+long tuning_limit ;                // max travel for max pwm step, 0.1 degrees
+int tuning_pwm ;                   // magnitude, pwm is tuning_dir * tuning_pwm
+int tuning_deadband_pwm ;          // last pwm before first movement seen
+long tuning_window_start_msecs ;
+long tuning_window_start_travel ;
+int tuning_lag_msecs ;             // -1 until first movement seen
+int tuning_rates[tuning_max_windows] ; // 0.1 degrees/sec
+byte tuning_last_result = tuning_result_none ;
+byte tuning_windows ;
+
+// Results, summed over both passes until the axis is done
+tuning_axis_results tuning_measured[2] ;
+
+// Set both axes tuning back to the config.h defaults
+void tuning_set_defaults()
+{
+  rotator_axis_tuning tuning ;
+  tuning.tolerance_degrees = az_tolerance_degrees ;
+  tuning.ramp_time_msecs = az_ramp_time_msecs ;
+  tuning.max_pwm = az_motor_max_pwm ;
+  tuning.min_pwm = az_motor_min_pwm ;
+  tuning.backlash_degrees = az_backlash_degrees ;
+  tuning.approach = az_approach ;
+  rotator_set_tuning(rotator_axis_az, &tuning);
+  tuning.tolerance_degrees = el_tolerance_degrees ;
+  tuning.ramp_time_msecs = el_ramp_time_msecs ;
+  tuning.max_pwm = el_motor_max_pwm ;
+  tuning.min_pwm = el_motor_min_pwm ;
+  tuning.backlash_degrees = el_backlash_degrees ;
+  tuning.approach = el_approach ;
+  rotator_set_tuning(rotator_axis_el, &tuning);
+}
+
+// Initial tuning, saved values if there are any otherwise the defaults
+void tuning_setup()
+{
+  rotator_axis_tuning az_tuning, el_tuning ;
+
+  tuning_set_defaults();
+
+  if ( EEPROM.read(eeprom_tuning) != tuning_eeprom_valid )
+    return ;
+
+  EEPROM.get(eeprom_tuning + 1, az_tuning);
+  EEPROM.get(eeprom_tuning + 1 + sizeof(rotator_axis_tuning), el_tuning);
+  if ( az_tuning.ramp_time_msecs > 0 && az_tuning.max_pwm > 0 && az_tuning.max_pwm <= 255 )
+    rotator_set_tuning(rotator_axis_az, &az_tuning);
+  if ( el_tuning.ramp_time_msecs > 0 && el_tuning.max_pwm > 0 && el_tuning.max_pwm <= 255 )
+    rotator_set_tuning(rotator_axis_el, &el_tuning);
+}
+
+// Save the current tuning to EEPROM, to be used from next reset
+void tuning_save()
+{
+  rotator_axis_tuning tuning ;
+
+  rotator_get_tuning(rotator_axis_az, &tuning);
+  EEPROM.put(eeprom_tuning + 1, tuning);
+  rotator_get_tuning(rotator_axis_el, &tuning);
+  EEPROM.put(eeprom_tuning + 1 + sizeof(rotator_axis_tuning), tuning);
+  EEPROM.update(eeprom_tuning, tuning_eeprom_valid);
+}
+
+// Forget any saved tuning and go back to the config.h defaults
+void tuning_restore_defaults()
+{
+  EEPROM.update(eeprom_tuning, 0xFF);
+  tuning_set_defaults();
+  trace_resync(); // tuning is part of the replay state
+}
+
+// Max pwm of the axis being tested
+int tuning_max_pwm()
+{
+  rotator_axis_tuning tuning ;
+  rotator_get_tuning(tuning_axis, &tuning);
+  return tuning.max_pwm ;
+}
+
+void tuning_start_phase(byte phase, long cur_msecs)
+{
+  tuning_phase = phase ;
+  tuning_phase_start_msecs = cur_msecs ;
+  tuning_window_start_msecs = cur_msecs ;
+  tuning_window_start_travel = 0 ;
+  tuning_travel = 0 ;
+  tuning_pwm = 0 ;
+}
+
+// Settle with the motor stopped, then start the given phase
+void tuning_settle(byte next_phase, long cur_msecs)
+{
+  tuning_start_phase(tuning_phase_settle, cur_msecs);
+  tuning_next_phase = next_phase ;
+}
+
+// Kept for tuning_result() rather than printed, as it runs from rotator_update()
+void tuning_stop(byte result)
+{
+  tuning_phase = tuning_phase_idle ;
+  tuning_pwm = 0 ;
+  tuning_last_result = result ;
+  debuglog_event(debuglog_identify, result, tuning_axis, 0);
+}
+
+// Travel left the given way from the last position seen before the margin
+// to the axis limits (the azimuth wrap or the elevation limits), 0.1 degrees
+long tuning_room(int8_t dir)
+{
+  long room ;
+  if ( tuning_axis == rotator_axis_az )
+    room = dir > 0 ? rotator_az_limit - tuning_heading : tuning_heading + rotator_az_limit ;
+  else
+    room = dir > 0 ? el_max_degrees * 10 - tuning_pitch : tuning_pitch - el_min_degrees * 10 ;
+  return room - tuning_margin_degrees * 10 ;
+}
+
+// Start the first pass of the next axis to do, or finish
+void tuning_start_axis(long cur_msecs)
+{
+  if ( tuning_axes_todo & tuning_axis_az )
+  {
+    tuning_axes_todo &= ~tuning_axis_az ;
+    tuning_axis = rotator_axis_az ;
+  }
+  else if ( tuning_axes_todo & tuning_axis_el )
+  {
+    tuning_axes_todo &= ~tuning_axis_el ;
+    tuning_axis = rotator_axis_el ;
+  }
+  else
+  {
+    tuning_stop(tuning_result_done);
+    return ;
+  }
+
+  // Start towards the limit with more room
+  tuning_dir = tuning_room(1) >= tuning_room(-1) ? 1 : -1 ;
+
+  tuning_pass = 0 ;
+  memset(&tuning_measured[tuning_axis], 0, sizeof(tuning_axis_results));
+  tuning_settle(tuning_phase_deadband, cur_msecs);
+}
+
+// Both directions measured, so set the axis tuning from them
+void tuning_finish_axis()
+{
+  tuning_axis_results * measured = &tuning_measured[tuning_axis] ;
+  rotator_axis_tuning tuning ;
+
+  measured->deadband_pwm /= 2 ;
+  measured->max_rate /= 2 ;
+  measured->rise_msecs /= 2 ;
+  measured->lag_msecs /= 2 ;
+  measured->coast /= 2 ;
+
+  rotator_get_tuning(tuning_axis, &tuning);
+  tuning.min_pwm = min(measured->deadband_pwm, tuning.max_pwm) ;
+
+  // Don't ramp faster than the axis can follow
+  tuning.ramp_time_msecs = max(measured->rise_msecs, tuning_min_ramp_msecs) ;
+
+  // Once within tolerance it ramps down, so travels for about half the ramp
+  // time plus the lag, then coasts. That has to stay inside the tolerance
+  // or it would overshoot and hunt back and forth.
+  long stopping = long(measured->max_rate) * ( tuning.ramp_time_msecs / 2 + measured->lag_msecs ) / 1000
+                  + measured->coast ;
+  tuning.tolerance_degrees = constrain(stopping / 10 + 2, tuning_min_tolerance_degrees, tuning_max_tolerance_degrees) ;
+
+  rotator_set_tuning(tuning_axis, &tuning);
+}
+
+// How far the axis may coast once the max pwm step ends, which has to fit
+// in the travel limit too: as far as the first pass coasted, or before then
+// as far as it goes at the last rate in the lag it took to start moving
+long tuning_coast_allowance()
+{
+  if ( tuning_pass > 0 )
+    return tuning_measured[tuning_axis].coast ;
+  if ( tuning_windows == 0 || tuning_lag_msecs < 0 )
+    return 0 ;
+  return max(0L, long(tuning_rates[tuning_windows - 1]) * tuning_lag_msecs / 1000) ;
+}
+
+// Max pwm step done, work out rate, rise and lag from the windows
+// Returns false if they don't make sense
+bool tuning_step_results()
+{
+  tuning_axis_results * measured = &tuning_measured[tuning_axis] ;
+
+  if ( tuning_windows < 3 || tuning_lag_msecs < 0 )
+    return false ;
+
+  int max_rate = ( tuning_rates[tuning_windows - 1] + tuning_rates[tuning_windows - 2] ) / 2 ;
+  if ( max_rate < tuning_min_rate )
+    return false ;
+
+  byte i = 0 ;
+  while ( tuning_rates[i] < long(max_rate) * 9 / 10 )
+    i++ ;
+
+  measured->max_rate += max_rate ;
+  measured->rise_msecs += ( i + 1 ) * tuning_window_msecs ;
+  measured->lag_msecs += tuning_lag_msecs ;
+  return true ;
+}
+
+// Start identifying the given axes (tuning_axis_* bits), the caller has
+// already stopped the motors
+void tuning_start(byte axes, int heading, int pitch, long cur_msecs)
+{
+  tuning_heading = heading ;
+  tuning_pitch = pitch ;
+  tuning_axes_todo = axes ;
+  tuning_start_axis(cur_msecs);
+}
+
+// Stop the routine, leaving the tuning as it was for any axis not finished
+void tuning_abort()
+{
+  if ( tuning_phase != tuning_phase_idle )
+    tuning_stop(tuning_result_aborted);
+}
+
+bool tuning_running()
+{
+  return tuning_phase != tuning_phase_idle ;
+}
+
+// How the last identification ended, or tuning_result_running
+byte tuning_result()
+{
+  return tuning_running() ? tuning_result_running : tuning_last_result ;
+}
+
+const __FlashStringHelper * tuning_result_name(byte result)
+{
+  switch ( result )
+  {
+    case tuning_result_running: return F("running");
+    case tuning_result_done: return F("done");
+    case tuning_result_aborted: return F("aborted");
+    case tuning_result_no_movement: return F("failed, no movement");
+    case tuning_result_no_travel: return F("failed, not enough travel or no movement");
+  }
+  return F("not run");
+}
+
+// Run the routine for one rotator_update(), returning the motor pwm to set
+void tuning_update(long cur_msecs, int heading, int pitch, int * az_pwm, int * el_pwm)
+{
+  // Travel of the axis being tested, allowing for heading wrapping around
+  int change ;
+  if ( tuning_axis == rotator_axis_az )
+  {
+    change = heading - tuning_heading ;
+    if ( change > 1800 ) change -= 3600 ;
+    if ( change < -1800 ) change += 3600 ;
+  }
+  else
+  {
+    change = pitch - tuning_pitch ;
+  }
+  tuning_heading = heading ;
+  tuning_pitch = pitch ;
+  tuning_travel += change * tuning_dir ;
+
+  long elapsed = cur_msecs - tuning_phase_start_msecs ;
+  long window = cur_msecs - tuning_window_start_msecs ;
+  int rate = 0 ;
+  bool window_done = window >= tuning_window_msecs ;
+  if ( window_done )
+  {
+    rate = ( ( tuning_travel - tuning_window_start_travel ) * 1000 ) / window ;
+    tuning_window_start_msecs = cur_msecs ;
+    tuning_window_start_travel = tuning_travel ;
+  }
+
+  switch ( tuning_phase )
+  {
+    case tuning_phase_settle:
+      if ( elapsed >= tuning_settle_msecs )
+      {
+        tuning_start_phase(tuning_next_phase, cur_msecs);
+        // Don't go past the azimuth wrap or elevation limits
+        tuning_limit = min(long(tuning_max_travel_degrees) * 10, tuning_room(tuning_dir)) ;
+        if ( tuning_next_phase == tuning_phase_step )
+        {
+          tuning_pwm = tuning_max_pwm() ;
+          tuning_lag_msecs = -1 ;
+          tuning_windows = 0 ;
+        }
+      }
+      break;
+
+    case tuning_phase_deadband:
+      // Moving has to be well clear of any sensor noise, but by then the pwm
+      // is past where it started moving, so use the pwm from first movement
+      if ( tuning_travel < tuning_first_movement )
+        tuning_deadband_pwm = tuning_pwm ;
+      if ( tuning_travel >= tuning_moved )
+      {
+        tuning_measured[tuning_axis].deadband_pwm += tuning_deadband_pwm ;
+        tuning_settle(tuning_phase_step, cur_msecs);
+      }
+      else if ( tuning_travel >= tuning_limit )
+      {
+        tuning_stop(tuning_result_no_travel);
+      }
+      else if ( elapsed >= long(tuning_pwm / tuning_deadband_step_pwm + 1) * tuning_deadband_step_msecs )
+      {
+        tuning_pwm += tuning_deadband_step_pwm ;
+        if ( tuning_pwm > tuning_max_pwm() )
+          tuning_stop(tuning_result_no_movement);
+      }
+      break;
+
+    case tuning_phase_step:
+      if ( tuning_lag_msecs < 0 && tuning_travel >= tuning_first_movement )
+        tuning_lag_msecs = elapsed ;
+      if ( window_done && tuning_windows < tuning_max_windows )
+        tuning_rates[tuning_windows++] = rate ;
+      if ( tuning_travel + tuning_coast_allowance() >= tuning_limit || tuning_windows == tuning_max_windows )
+      {
+        if ( tuning_step_results() )
+          tuning_start_phase(tuning_phase_coast, cur_msecs);
+        else
+          tuning_stop(tuning_result_no_travel);
+      }
+      break;
+
+    case tuning_phase_coast:
+      if ( ( window_done && abs(rate) < tuning_min_rate ) || elapsed >= tuning_max_coast_msecs )
+      {
+        tuning_measured[tuning_axis].coast += tuning_travel ;
+        if ( tuning_pass == 0 )
+        {
+          // Now back the other way
+          tuning_pass = 1 ;
+          tuning_dir = - tuning_dir ;
+          tuning_settle(tuning_phase_deadband, cur_msecs);
+        }
+        else
+        {
+          tuning_finish_axis();
+          tuning_start_axis(cur_msecs);
+        }
+      }
+      break;
+  }
+
+  *az_pwm = tuning_axis == rotator_axis_az ? tuning_dir * tuning_pwm : 0 ;
+  *el_pwm = tuning_axis == rotator_axis_el ? tuning_dir * tuning_pwm : 0 ;
+}
+
+// Results of the last identification of an axis (rotator_axis_*)
+void tuning_results(byte axis, tuning_axis_results * results)
+{
+  *results = tuning_measured[axis] ;
+}
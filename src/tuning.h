@@ -0,0 +1,42 @@
+// Functions related to identifying and tuning each axis of the rotator
+// rototor_areg
+// VK5CD
+//
+// The identification routine drives each axis itself, in both directions, to
+// measure how it responds to the motor pwm, and from that works out the
+// tuning used by the normal motor control (see rotator_axis_tuning)
+
+#include <Arduino.h>
+
+// Axes to identify (bit mask)
+const byte tuning_axis_az = 0x01 ;
+const byte tuning_axis_el = 0x02 ;
+
+// What was measured for one axis, averaged over both directions
+struct tuning_axis_results
+{
+  int16_t deadband_pwm;      // least pwm that moves the axis
+  int16_t max_rate;          // steady rate at max pwm, 0.1 degrees/sec
+  int16_t rise_msecs;        // time to reach 90% of max rate from a step to max pwm
+  int16_t lag_msecs;         // time from step to max pwm until first movement seen
+  int16_t coast;             // travel after pwm set to 0 from max rate, 0.1 degrees
+};
+
+// Result of the last identification, see tuning_result()
+const byte tuning_result_none = 0 ;        // not run since reset
+const byte tuning_result_running = 1 ;
+const byte tuning_result_done = 2 ;
+const byte tuning_result_aborted = 3 ;
+const byte tuning_result_no_movement = 4 ;
+const byte tuning_result_no_travel = 5 ;   // not enough travel or no movement at max pwm
+
+void tuning_setup();
+void tuning_start(byte axes, int heading, int pitch, long cur_msecs);
+void tuning_abort();
+bool tuning_running();
+byte tuning_result();
+const __FlashStringHelper * tuning_result_name(byte result);
+void tuning_update(long cur_msecs, int heading, int pitch, int * az_pwm, int * el_pwm);
+void tuning_results(byte axis, tuning_axis_results * results);
+void tuning_save();
+void tuning_restore_defaults();